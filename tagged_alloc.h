@@ -1,6 +1,11 @@
 #pragma once
 
 #include "pch.h"
+#include <new>
+#include <atomic>
+#include <cstdarg>
+#include <utility>
+#include <type_traits>
 
 /*
  * Tagged allocator. Tracks allocations with size, time, tag (4 chars), and the pointer.
@@ -22,13 +27,146 @@ Example usage:
   TaggedAlloc::Free(obj);
   TaggedAlloc::Free(array);
 
+  // buffers that are about to be overwritten anyway can skip the zeroing step
+  uint8_t* audioBuffer = TaggedAlloc::AllocateArrayUninitialized<uint8_t>(65536, "Audi");
+  // or switch a whole tag over without touching the call sites
+  TaggedAlloc::SetTagZeroing("Audi", false);
+
+  // objects can be constructed and destructed in place, with constructor arguments forwarded through
+  SomeClass* thing = TaggedAlloc::New<SomeClass>("Thng", 1, 2.0f);
+  SomeClass* things = TaggedAlloc::NewArray<SomeClass>(8, "Thng");
+  TaggedAlloc::Delete(thing);
+  TaggedAlloc::DeleteArray(things);
+
+  // grow a tracked buffer, in place if the heap allows it
+  float* samples = TaggedAlloc::AllocateArray<float>(32, "Smpl");
+  samples = TaggedAlloc::Reallocate(samples, 64);
+
+  // speculative allocation that returns nullptr rather than asserting
+  uint8_t* frameBuffer = TaggedAlloc::TryAllocateArray<uint8_t>(320 * 240 * 2, "FrBf");
+
+  // allocate and free lots of small things under a single lock acquisition
+  Node* nodes[32];
+  TaggedAlloc::AllocateBatch(nodes, 32, "Node");
+  TaggedAlloc::FreeBatch(nodes, 32);
+
+  // subsystems can have their own independent instance, with their own table, lock and sizing
+  struct AudioAllocConfig : TaggedAllocDefaultConfig
+  {
+    static const char* Name() { return "audio"; }
+    static const size_t InitialTableSize = 16;
+  };
+  typedef TaggedAllocT<AudioAllocConfig> AudioAlloc;
+  AudioAlloc::Init();
+  int16_t* samples = AudioAlloc::AllocateArray<int16_t>(1024, "Smpl");
+  size_t everything = TaggedAllocRegistry::GetTotalSize();
+
+  // high-churn objects can be recycled through a pool. each chunk of objects is a single entry in the table.
+  TaggedAlloc::Pool<Packet> packetPool("Pkt_");
+  Packet* packet = packetPool.New();
+  packetPool.Delete(packet);
+
+  // long-lived buffers can be made movable, so that Compact() can shuffle them down the heap to coalesce free space.
+  // the pointer is only valid between Pin() and Unpin().
+  TaggedAlloc::Handle<uint8_t> log = TaggedAlloc::AllocateMovable<uint8_t>(4096, "Log_");
+  uint8_t* logData = TaggedAlloc::Pin(log);
+  TaggedAlloc::Unpin(log);
+  TaggedAlloc::CompactionStats compaction = TaggedAlloc::Compact();
+  TaggedAlloc::FreeMovable(log);
+
+  // standard containers can be tracked too, with the tag given at compile time
+  std::vector<int, TaggedStdAllocator<int, TaggedAllocMakeTag("Vect")>> vec;
+  std::map<int, int, std::less<int>, TaggedStdAllocator<std::pair<const int, int>, TaggedAllocMakeTag("Map_")>> map;
+
+  // with TAGGED_ALLOC_REPLACE_GLOBAL_NEW defined in one .cpp file, plain new/delete is tracked too.
+  // the tag comes from the innermost TaggedAllocTagScope on the current task, or TAGGED_ALLOC_DEFAULT_TAG if there isn't one.
+  {
+    TaggedAllocTagScope scope("Netw");
+    LegacyThing* legacy = new LegacyThing();
+    delete legacy;
+  }
+
+  // with TAGGED_ALLOC_WRAP_MALLOC (and the matching linker flags), C libraries' malloc()/free() calls are tracked too.
+  // blocks are tagged by which registered code range called malloc(), or TAGGED_ALLOC_WRAP_DEFAULT_TAG if none matched.
+  TaggedAllocMallocWrap::RegisterCallerTag(&_lwip_text_start, &_lwip_text_end, "lwIP");
+
+  // cap a subsystem's memory use. allocations over budget fail, wait for the tag to free something, or are logged and let through.
+  TaggedAlloc::SetTagBudget("Audi", 96 * 1024, 0, TaggedAlloc::BudgetBlock, pdMS_TO_TICKS(50));
+  size_t audioHeadroom = TaggedAlloc::GetTagHeadroom("Audi");
+
+  // constant-time queries on a pointer you've been handed
+  if (TaggedAlloc::IsTracked(buffer))
+  {
+    size_t bufferSize = TaggedAlloc::GetAllocationSize(buffer);
+  }
+
+  // with TAGGED_ALLOC_PUBLISHED_VIEW_SIZE set, readers can look at a published copy of the table without ever taking the lock
+  const TaggedAlloc::PublishedView* view = TaggedAlloc::AcquirePublishedView();
+  uint32_t changesBehind = TaggedAlloc::GetChangeGeneration() - view->Generation;
+  TaggedAlloc::ReleasePublishedView(view);
+
+  // walk every allocation. the lock is only held while each chunk is copied out, not while the visitor runs.
+  TaggedAlloc::ForEachAllocation([](const TaggedAllocationDescriptor& allocation) {
+    return allocation.Size < 65536; // return false to stop early
+  });
+
+  // stats can go to any Print, not just Serial. on a host build, TaggedAllocFilePrint sends them to a FILE*.
+  TaggedAlloc::PrintStats(telnetClient);
+  // or in a compact binary format (see "Binary stats format" below), for tools to parse
+  size_t bytesSent = TaggedAlloc::WriteBinaryStats(telnetClient);
+
+  // capture the table without allocating anything, a chunk at a time
+  TaggedAllocationDescriptor descriptors[16];
+  size_t written;
+  size_t cursor = 0;
+  bool complete;
+  do
+  {
+    complete = TaggedAlloc::Snapshot(descriptors, 16, &written, &cursor);
+    // ... use the first written descriptors ...
+  } while (!complete);
+
+  // with TAGGED_ALLOC_CHANGE_LOG_SIZE set, report just what's changed since last time
+  TaggedAlloc::TableChange changes[32];
+  size_t changeCount;
+  switch (TaggedAlloc::SnapshotSince(lastGeneration, changes, 32, &changeCount, &lastGeneration))
+  {
+    case TaggedAlloc::DeltaOk: // that's everything
+    case TaggedAlloc::DeltaMore: // there's more, call again
+    case TaggedAlloc::DeltaOverrun: // too much has changed, take a full snapshot instead
+      break;
+  }
+
+  // with TAGGED_ALLOC_TRACE_SIZE set, recent allocs and frees are kept in a ring for post-mortem analysis
+  TaggedAlloc::TraceEvent events[16];
+  size_t eventCount = TaggedAlloc::DrainTrace(events, 16);
+
+  // allocations that have been around for more than 5 minutes, at most 4 per tag
+  TaggedAllocationDescriptor longLived[16];
+  size_t longLivedCount = TaggedAlloc::FindLongLived(5 * 60 * 1000, 4, longLived, 16);
+  // with TAGGED_ALLOC_LEAK_EPOCHS set, call this from a timer. it returns the tags whose count of old allocations keeps on growing.
+  TaggedAlloc::LeakSuspect suspects[4];
+  size_t suspectCount = TaggedAlloc::LeakWatchTick(suspects, 4);
+
+  // find the allocation that a faulting address falls inside (O(log n) with TAGGED_ALLOC_ADDRESS_INDEX set to 1)
+  TaggedAllocationDescriptor owner;
+  if (TaggedAlloc::FindContaining(faultAddress, &owner))
+  {
+    Serial.write((uint8_t*)owner.Tag, 4);
+  }
+
+  // let subsystems drop caches when memory gets tight, before allocations start failing.
+  // this runs when more than 200KB is tracked or free heap drops below 32KB, and whenever an allocation fails.
+  TaggedAlloc::RegisterReclaimer("Imgs", DropImageCache, 10, 200 * 1024, 32 * 1024);
+
 */
 
 /*
  * NOTE: 
- * The current memory allocation failure policy is to throw an assertion failure. This ensures quick clean failure in the case where something goes wrong.
+ * The default memory allocation failure policy is to throw an assertion failure. This ensures quick clean failure in the case where something goes wrong.
  * This may not be ideal for all circumstances, e.g. speculative allocation of large buffers to see if there's enough memory to perform an action.
- * Future versions of this code will include a global policy option and per-call "don't panic" flag.
+ * For those cases, use TryAllocate/TryAllocateArray (which return nullptr instead of panicking), or change the global policy with SetFailurePolicy().
+ * Either way, a failed allocation never leaves anything behind in the allocation table.
  */
 
 /*
@@ -51,6 +189,7 @@ compiler.S.extra_flags={extras.defines}
  * See: https://github.com/espressif/arduino-esp32/issues/4851
  * This means that we must dynamically allocate a mutex at the Init() call. This means that Init() can fail if memory is very low when it is called.
  * For now this is just accepted, there's nothing we can do.
+ * On platforms where the static functions do exist, define TAGGED_ALLOC_STATIC_MUTEX to use static storage for the mutex instead.
  * 
  */
 
@@ -85,497 +224,5400 @@ compiler.S.extra_flags={extras.defines}
 #define TAGGED_ALLOC_WAIT_TIME (5 / portTICK_PERIOD_MS) 
 #endif
 
+// when the failure policy is FailCallHandler, this is the maximum number of times the handler will be called (and the allocation retried) per allocation
+#ifndef TAGGED_ALLOC_FAILURE_RETRIES
+#define TAGGED_ALLOC_FAILURE_RETRIES 3
+#endif
+
+// set this to a non-zero entry count to use a fixed-capacity allocation table in static storage, instead of one on the heap.
+// in this mode the table never grows, shrinks, or gets defragmented, so tracking uses no heap at all (combine with TAGGED_ALLOC_STATIC_MUTEX for the mutex too).
+// overflow behaviour: if the table is full, the new allocation is freed again and the failure policy applies, exactly as if malloc() had failed.
+// worst-case timing: inserts and removes are each a single linear scan of the table, so they're bounded by TAGGED_ALLOC_STATIC_TABLE_SIZE entries.
+// the other table settings above are ignored in this mode. TaggedAllocStatic<N> gives you an instance in this mode without changing the default one.
+#ifndef TAGGED_ALLOC_STATIC_TABLE_SIZE
+#define TAGGED_ALLOC_STATIC_TABLE_SIZE 0
+#endif
+
+// uncomment this to create the table mutex in static storage. this requires xSemaphoreCreateRecursiveMutexStatic, which arduino-esp32 doesn't currently have (see above).
+//#define TAGGED_ALLOC_STATIC_MUTEX
+
 // uncomment this if you want to save a little bit of memory (and some millis() calls) by not tracking the allocation time
 //#define TAGGED_ALLOC_NO_TIME_TRACKING
 
+// the maximum number of distinct tags that can have per-tag settings (e.g. zeroing policy) and running totals attached to them.
+// this must be a power of two, since the tag table is a small open-addressed hash table.
+// tags get an entry automatically the first time they're allocated with, but only up to three quarters of the table. the last quarter is kept for
+// tags that are given settings (SetTagZeroing(), SetTagBudget(), RegisterReclaimer()), so that configuring a tag can't fail just because lots of
+// other tags have been seen, and so that the table always has empty entries to end lookups of unknown tags quickly.
+#ifndef TAGGED_ALLOC_MAX_TAGS
+#define TAGGED_ALLOC_MAX_TAGS 32
+#endif
 
-/**********
- * Macros *
- **********/
+// set this to 1 to keep an address-ordered index of the allocations, so that FindContaining() and FindInRange() are O(log n) rather than scanning the table.
+// this costs one size_t per table entry, plus a memmove of part of the index on each allocation and free.
+#ifndef TAGGED_ALLOC_ADDRESS_INDEX
+#define TAGGED_ALLOC_ADDRESS_INDEX 0
+#endif
 
-// macro to check if a particular TaggedAllocationDescriptor is valid
-#define TAGGED_ALLOC_IS_VALID(t) ((t).Object != nullptr)
+// how many descriptors ForEachAllocation() (and so PrintStats()) copies out of the table at a time. the buffer for them lives on the stack.
+#ifndef TAGGED_ALLOC_ITERATION_CHUNK_SIZE
+#define TAGGED_ALLOC_ITERATION_CHUNK_SIZE 16
+#endif
 
+// capacity of the published view of the table (see AcquirePublishedView()). 0 turns it off.
+// when it's on, two copies of this many descriptors live in static storage: one for readers, and one that's refilled as the table changes.
+#ifndef TAGGED_ALLOC_PUBLISHED_VIEW_SIZE
+#define TAGGED_ALLOC_PUBLISHED_VIEW_SIZE 0
+#endif
 
-/********************
- * Class definition *
- ********************/
+// the published view is refreshed after this many changes to the table...
+#ifndef TAGGED_ALLOC_PUBLISH_CHANGES
+#define TAGGED_ALLOC_PUBLISH_CHANGES 64
+#endif
 
-class TaggedAlloc
-{  
-private:
-  // internal descriptor struct for allocations
-  struct TaggedAllocationDescriptor
-  {
-    void* Object;
-    size_t Size;
-    char Tag[4];
-#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
-    uint32_t Time;
+// ...or on the first change this long (in ms) after the last refresh, whichever comes first
+#ifndef TAGGED_ALLOC_PUBLISH_INTERVAL_MS
+#define TAGGED_ALLOC_PUBLISH_INTERVAL_MS 1000
 #endif
-  };
 
-  // this is set when Init() is called, to signify that we have initialised OK.
-  static bool InitOK;
-  // number of active allocations that are present in the table.
-  static size_t AllocationCount;
-  // the size (in entries, not bytes) of the allocation table.
-  static size_t AllocationTableSize;
-  // the allocation table. this stores the allocation descriptors.
-  static TaggedAllocationDescriptor* AllocationTable;
-  // mutex for the allocation table.
-  static SemaphoreHandle_t AllocationTableMutex;
-  //static StaticSemaphore_t AllocationTableMutexStatic;
+// number of changes to the table kept for SnapshotSince(). must be a power of two. 0 turns the change log off.
+#ifndef TAGGED_ALLOC_CHANGE_LOG_SIZE
+#define TAGGED_ALLOC_CHANGE_LOG_SIZE 0
+#endif
 
+// number of events kept in the allocation trace ring (see DrainTrace()). must be a power of two. 0 turns tracing off, and compiles it out.
+#ifndef TAGGED_ALLOC_TRACE_SIZE
+#define TAGGED_ALLOC_TRACE_SIZE 0
+#endif
 
-  // this sets the allocation time using millis()
-  // you can turn the time tracking off by defining TAGGED_ALLOC_NO_TIME_TRACKING
-  static inline void SetTaggedAllocationDescriptorTime(TaggedAllocationDescriptor* allocation) __attribute__((always_inline))
-  {
-#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
-    allocation->Time = millis();
+// leak watch. each tag counts its live allocations by the epoch they were made in, for the last TAGGED_ALLOC_LEAK_EPOCHS epochs of
+// TAGGED_ALLOC_LEAK_EPOCH_MS each. anything older than that counts as old. a tag whose old count has gone up in at least
+// TAGGED_ALLOC_LEAK_GROWTH_EPOCHS of the last TAGGED_ALLOC_LEAK_WINDOW_EPOCHS epochs, and hasn't gone down in any of them, is reported as a
+// leak suspect. 0 epochs (the default) turns this off, so nothing pays for it unless it's wanted. it needs time tracking.
+#ifndef TAGGED_ALLOC_LEAK_EPOCH_MS
+#define TAGGED_ALLOC_LEAK_EPOCH_MS 10000
 #endif
-  }
-  
-  static bool IsAllocationTableFragmented(size_t start, size_t* firstEmptyIndex, size_t* firstValidIndex);
-  static void DefragAllocationTable();
-  static bool GetFirstEmptySlot(size_t* index);
-  static void ResizeAllocationTable(size_t entryCount);
-  static void InsertAllocation(TaggedAllocationDescriptor ta);
-  static void RemoveAllocation(void* objectPointer);
-  
-  template<typename T>
-  static T* AllocateInternal(size_t count, char tag[4]);
 
-public:
-  // Initialise. This must be called at least once before any allocations can be performed.
-  static void Init()
-  {
-    /*  Note that this is technically a race condition here, where if two calls are made to Init() at the same time (by two different cores) 
-     *  and no call to Init() has been made before, we could end up initialising twice and making a mess of things.
-     *  You can solve this by calling Init() in your setup function, rather than trying to lazily initialise in tasks or something weird.
-     */
-    if (InitOK)
-    {
-      return;
-    }
+#ifndef TAGGED_ALLOC_LEAK_EPOCHS
+#define TAGGED_ALLOC_LEAK_EPOCHS 0
+#endif
 
-    // normally I'd use static allocation here, but arduino-esp32 didn't include the static implementations.
-    // see: https://github.com/espressif/arduino-esp32/issues/4851
-    //AllocationTableMutex = xSemaphoreCreateRecursiveMutexStatic(&AllocationTableMutexStatic);
-    AllocationTableMutex = xSemaphoreCreateRecursiveMutex();
-    assert(AllocationTableMutex);
+#ifndef TAGGED_ALLOC_LEAK_GROWTH_EPOCHS
+#define TAGGED_ALLOC_LEAK_GROWTH_EPOCHS 3
+#endif
 
-    size_t allocationBufferSize = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
-    AllocationTable = static_cast<TaggedAllocationDescriptor*>(malloc(allocationBufferSize));
-    assert(AllocationTable);
-    // zero the buffer! this is critical and forgetting to do so caused a bug previously :(
-    memset(AllocationTable, 0, allocationBufferSize);
+// must be at least TAGGED_ALLOC_LEAK_GROWTH_EPOCHS, and at most 32
+#ifndef TAGGED_ALLOC_LEAK_WINDOW_EPOCHS
+#define TAGGED_ALLOC_LEAK_WINDOW_EPOCHS 6
+#endif
 
-    InitOK = true;
-    
-    assert(heap_caps_check_integrity_all(true));
-  }
-  
-  static size_t GetAllocationCount();
+// longest line PrintStats() can print. each line is formatted into a buffer this big on the stack, then written out in one go.
+#ifndef TAGGED_ALLOC_PRINT_LINE_SIZE
+#define TAGGED_ALLOC_PRINT_LINE_SIZE 128
+#endif
 
-  static size_t GetAllocationTableSize();
+// the maximum number of reclaim callbacks that can be registered with RegisterReclaimer()
+#ifndef TAGGED_ALLOC_MAX_RECLAIMERS
+#define TAGGED_ALLOC_MAX_RECLAIMERS 8
+#endif
 
-  static size_t GetTotalSize();
-  
-  static void PrintStats();
+// the number of size classes supported by the pre-zeroed block pool. 0 (the default) turns the pool off.
+// when enabled, call ConfigureZeroPool() after Init() to set the block sizes and start the background refill task.
+#ifndef TAGGED_ALLOC_ZERO_POOL_CLASSES
+#define TAGGED_ALLOC_ZERO_POOL_CLASSES 0
+#endif
 
-  template<typename T>
-  static T* Allocate(char tag[4]);
+// the number of ready-to-use zeroed blocks kept in each size class of the pool
+#ifndef TAGGED_ALLOC_ZERO_POOL_DEPTH
+#define TAGGED_ALLOC_ZERO_POOL_DEPTH 4
+#endif
 
-  template<typename T>
-  static T* AllocateArray(size_t count, char tag[4]);
+// stack size (in bytes) for the pool refill task
+#ifndef TAGGED_ALLOC_ZERO_POOL_STACK_SIZE
+#define TAGGED_ALLOC_ZERO_POOL_STACK_SIZE 2048
+#endif
 
-  template<typename T>
-  static void Free(T* object);
-};
+// TaggedStdAllocator serves single-node allocations (e.g. std::map/std::list nodes) up to this size from a per-tag node cache,
+// so that each node doesn't cost a table insert and remove. 0 turns the node cache off.
+#ifndef TAGGED_ALLOC_STD_NODE_MAX_SIZE
+#define TAGGED_ALLOC_STD_NODE_MAX_SIZE 64
+#endif
 
+// how many nodes the node cache allocates at once. each chunk of nodes is a single entry in the allocation table.
+#ifndef TAGGED_ALLOC_STD_NODES_PER_CHUNK
+#define TAGGED_ALLOC_STD_NODES_PER_CHUNK 32
+#endif
 
-/************************
- * Static variable init *
- ************************/
+// the maximum number of live movable allocations (see AllocateMovable()) per instance
+#ifndef TAGGED_ALLOC_MAX_MOVABLE
+#define TAGGED_ALLOC_MAX_MOVABLE 32
+#endif
 
-bool TaggedAlloc::InitOK = false;
-size_t TaggedAlloc::AllocationCount = 0;
-size_t TaggedAlloc::AllocationTableSize = TAGGED_ALLOC_INITIAL_TABLE_SIZE;
-TaggedAlloc::TaggedAllocationDescriptor* TaggedAlloc::AllocationTable = nullptr;
-SemaphoreHandle_t TaggedAlloc::AllocationTableMutex = nullptr;
-//StaticSemaphore_t TaggedAlloc::AllocationTableMutexStatic;
+// the default number of objects in each chunk of a TaggedAlloc::Pool
+#ifndef TAGGED_ALLOC_POOL_OBJECTS_PER_CHUNK
+#define TAGGED_ALLOC_POOL_OBJECTS_PER_CHUNK 16
+#endif
 
+// define TAGGED_ALLOC_REPLACE_GLOBAL_NEW in exactly one .cpp file, before including this header, to replace the global operator new/delete
+// (including the nothrow, sized and aligned variants) with versions that track allocations in the default TaggedAlloc instance.
+// allocations made before TaggedAlloc::Init() is called go straight to malloc(), and deleting them later is fine.
+// overhead: each new costs a table insert and each delete costs a table lookup, on top of the malloc()/free() that plain new/delete do.
+//#define TAGGED_ALLOC_REPLACE_GLOBAL_NEW
 
-/********************
- * Public functions *
- ********************/
+// the tag used for global new when there's no TaggedAllocTagScope active on the current task
+#ifndef TAGGED_ALLOC_DEFAULT_TAG
+#define TAGGED_ALLOC_DEFAULT_TAG "New_"
+#endif
 
-// allocate a thing
-template<typename T>
-T* TaggedAlloc::Allocate(char tag[4])
-{
-  return AllocateInternal<T>(1, tag);
-}
+// define TAGGED_ALLOC_WRAP_MALLOC for the whole build (like the mutex defines above), and add this to the linker flags:
+//   -Wl,--wrap=malloc,--wrap=free,--wrap=calloc,--wrap=realloc
+// to route every malloc()/free()/calloc()/realloc() call in the firmware (including C libraries like lwIP and mbedTLS) through the default TaggedAlloc instance.
+// the tracker's own heap calls go directly to the real functions in this mode, which is why the define has to be seen by every file that includes this header.
+// this relies on the GNU linker's --wrap; LD_PRELOAD-style interposition on host builds isn't supported.
+//#define TAGGED_ALLOC_WRAP_MALLOC
 
+// wrapped allocations smaller than this aren't tracked, which keeps the overhead bounded for the flood of tiny allocations most C libraries make.
+#ifndef TAGGED_ALLOC_WRAP_MIN_SIZE
+#define TAGGED_ALLOC_WRAP_MIN_SIZE 64
+#endif
 
-// allocate an array of things
-template<typename T>
-T* TaggedAlloc::AllocateArray(size_t count, char tag[4])
-{
-  return AllocateInternal<T>(count, tag);
-}
+// the tag for wrapped allocations whose caller isn't in any range registered with TaggedAllocMallocWrap::RegisterCallerTag()
+#ifndef TAGGED_ALLOC_WRAP_DEFAULT_TAG
+#define TAGGED_ALLOC_WRAP_DEFAULT_TAG "Libc"
+#endif
 
+// the maximum number of caller ranges that can be registered for tagging wrapped allocations
+#ifndef TAGGED_ALLOC_WRAP_MAX_CALLER_TAGS
+#define TAGGED_ALLOC_WRAP_MAX_CALLER_TAGS 8
+#endif
 
-// free the thing
-template<typename T>
-void TaggedAlloc::Free(T* object)
+
+/**********
+ * Macros *
+ **********/
+
+// macro to check if a particular TaggedAllocationDescriptor is valid
+#define TAGGED_ALLOC_IS_VALID(t) ((t).Object != nullptr)
+
+// rounds n up to a power of two. this is constexpr so that it can size static arrays.
+constexpr size_t TaggedAllocCeilPowerOfTwo(size_t n)
 {
-  // remove the allocation from the table, then free the object
-  RemoveAllocation((void*)object);
-  free(object);
+  return (n <= 1) ? 1 : 2 * TaggedAllocCeilPowerOfTwo((n + 1) / 2);
 }
 
+// the heap functions used by the tracker. when malloc() and friends are wrapped, these have to bypass the wrappers.
+#ifdef TAGGED_ALLOC_WRAP_MALLOC
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_calloc(size_t count, size_t size);
+extern "C" void* __real_realloc(void* object, size_t size);
+extern "C" void __real_free(void* object);
+#define TAGGED_ALLOC_MALLOC(size) __real_malloc(size)
+#define TAGGED_ALLOC_CALLOC(count, size) __real_calloc(count, size)
+#define TAGGED_ALLOC_REALLOC(object, size) __real_realloc(object, size)
+#define TAGGED_ALLOC_FREE(object) __real_free(object)
+#else
+#define TAGGED_ALLOC_MALLOC(size) malloc(size)
+#define TAGGED_ALLOC_CALLOC(count, size) calloc(count, size)
+#define TAGGED_ALLOC_REALLOC(object, size) realloc(object, size)
+#define TAGGED_ALLOC_FREE(object) free(object)
+#endif
 
-// how many allocations do we have?
-size_t TaggedAlloc::GetAllocationCount()
-{
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  size_t count = AllocationCount;
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
 
-  return count;
-}
 
+/*******************
+ * Instance config *
+ *******************/
 
-// how big is the table?
-size_t TaggedAlloc::GetAllocationTableSize()
+// the default configuration, built from the TAGGED_ALLOC_* settings above. this is what the TaggedAlloc instance uses.
+// to get an independent instance (with its own table, lock and sizing), derive a config from this, override whatever you need, and use it with TaggedAllocT.
+// each distinct config type gets its own instance, so two subsystems that want separate tables need separate config types even if the values are the same.
+struct TaggedAllocDefaultConfig
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  size_t size = AllocationTableSize;
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
-
-  return size;
-}
+  // name of the instance, used in the aggregate stats
+  static const char* Name() { return "default"; }
+  static const size_t MinTableSize = TAGGED_ALLOC_MIN_TABLE_SIZE;
+  static const size_t InitialTableSize = TAGGED_ALLOC_INITIAL_TABLE_SIZE;
+  static const size_t TableShrinkStep = TAGGED_ALLOC_TABLE_SHRINK_STEP;
+  static const size_t TableExpandStep = TAGGED_ALLOC_TABLE_EXPAND_STEP;
+  static const TickType_t WaitTime = TAGGED_ALLOC_WAIT_TIME;
+  static const size_t FailureRetries = TAGGED_ALLOC_FAILURE_RETRIES;
+  // non-zero for a fixed-capacity table in static storage (see TAGGED_ALLOC_STATIC_TABLE_SIZE)
+  static const size_t StaticTableSize = TAGGED_ALLOC_STATIC_TABLE_SIZE;
+  // must be a power of two
+  static const size_t MaxTags = TAGGED_ALLOC_MAX_TAGS;
+  static const size_t MaxReclaimers = TAGGED_ALLOC_MAX_RECLAIMERS;
+  static const size_t MaxMovable = TAGGED_ALLOC_MAX_MOVABLE;
+  // keep an address-ordered index (see TAGGED_ALLOC_ADDRESS_INDEX)
+  static const bool AddressIndex = TAGGED_ALLOC_ADDRESS_INDEX != 0;
+  // published view of the table (see TAGGED_ALLOC_PUBLISHED_VIEW_SIZE)
+  static const size_t PublishedViewSize = TAGGED_ALLOC_PUBLISHED_VIEW_SIZE;
+  static const uint32_t PublishChanges = TAGGED_ALLOC_PUBLISH_CHANGES;
+  static const uint32_t PublishIntervalMs = TAGGED_ALLOC_PUBLISH_INTERVAL_MS;
+  // change log for SnapshotSince() (see TAGGED_ALLOC_CHANGE_LOG_SIZE)
+  static const size_t ChangeLogSize = TAGGED_ALLOC_CHANGE_LOG_SIZE;
+  // allocation trace ring (see TAGGED_ALLOC_TRACE_SIZE)
+  static const size_t TraceSize = TAGGED_ALLOC_TRACE_SIZE;
+  // leak watch (see TAGGED_ALLOC_LEAK_EPOCHS)
+  static const uint32_t LeakEpochMs = TAGGED_ALLOC_LEAK_EPOCH_MS;
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  static const size_t LeakEpochs = TAGGED_ALLOC_LEAK_EPOCHS;
+#else
+  static const size_t LeakEpochs = 0;
+#endif
+  static const uint32_t LeakGrowthEpochs = TAGGED_ALLOC_LEAK_GROWTH_EPOCHS;
+  static const uint32_t LeakWindowEpochs = TAGGED_ALLOC_LEAK_WINDOW_EPOCHS;
+  // pre-zeroed block pool (see TAGGED_ALLOC_ZERO_POOL_CLASSES)
+  static const size_t ZeroPoolClasses = TAGGED_ALLOC_ZERO_POOL_CLASSES;
+  static const size_t ZeroPoolDepth = TAGGED_ALLOC_ZERO_POOL_DEPTH;
+  static const uint32_t ZeroPoolStackSize = TAGGED_ALLOC_ZERO_POOL_STACK_SIZE;
+};
 
 
-// what's the sum of the size of all the allocations?
-size_t TaggedAlloc::GetTotalSize()
+// config for a fixed-capacity instance. Id lets you have more than one instance with the same capacity.
+template<size_t Capacity, int Id = 0>
+struct TaggedAllocStaticConfig : TaggedAllocDefaultConfig
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  size_t totalSize = 0;
-  for (size_t index = 0; index < AllocationTableSize; index++)
+  // e.g. "static<4096>", or "static<4096,1>" for a non-zero Id
+  static const char* Name()
+  {
+    // the name is built by a function-local static's constructor, which the compiler guarantees runs exactly once even if two tasks
+    // ask for it at the same time (filling in a plain buffer on first use could hand one of them a half-written name)
+    static const NameBuffer name;
+    return name.Text;
+  }
+  static const size_t StaticTableSize = Capacity;
+
+private:
+  struct NameBuffer
   {
-    if (TAGGED_ALLOC_IS_VALID(AllocationTable[index]))
+    char Text[32];
+
+    NameBuffer()
     {
-      totalSize += AllocationTable[index].Size;
+      if (Id == 0)
+      {
+        snprintf(Text, sizeof(Text), "static<%lu>", (unsigned long)Capacity);
+      }
+      else
+      {
+        snprintf(Text, sizeof(Text), "static<%lu,%d>", (unsigned long)Capacity, Id);
+      }
     }
-  }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
-  
-  return totalSize;
+  };
+};
+
+
+// packs a 4 character tag into an integer, so that it can be used as a template argument, e.g. TaggedAllocMakeTag("Vect")
+constexpr uint32_t TaggedAllocMakeTag(const char (&tag)[5])
+{
+  return (uint32_t)(uint8_t)tag[0] | ((uint32_t)(uint8_t)tag[1] << 8) | ((uint32_t)(uint8_t)tag[2] << 16) | ((uint32_t)(uint8_t)tag[3] << 24);
 }
 
 
-// show some stats over serial output
-void TaggedAlloc::PrintStats()
+// unpacks a tag made with TaggedAllocMakeTag()
+inline void TaggedAllocUnpackTag(uint32_t packedTag, char tag[4])
 {
-  Serial.println("*** TAGGED ALLOCATION STATS ***");
-  Serial.println("Capturing allocation table...");
+  tag[0] = (char)(packedTag & 0xFF);
+  tag[1] = (char)((packedTag >> 8) & 0xFF);
+  tag[2] = (char)((packedTag >> 16) & 0xFF);
+  tag[3] = (char)((packedTag >> 24) & 0xFF);
+}
 
-  // calls to Serial functions may take a lot of time, so it isn't practical to hold the lock on the descriptor table while we print stats.
-  // instead, we capture a copy of the allocation table and work on that. the downside is that we have to malloc() space for a copy.
-  bool capturedCopyOK = false;
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  size_t tableBufferSize = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
-  size_t tableEntryCount = AllocationTableSize;
-  size_t allocCount = AllocationCount;
-  size_t allocSizeTotal = GetTotalSize();
-  // try to allocate space for a copy of the table
-  TaggedAllocationDescriptor* allocationTableCopy = static_cast<TaggedAllocationDescriptor*>(malloc(tableBufferSize));
-  
-  if (allocationTableCopy)
+
+/****************
+ * Tag contexts *
+ ****************/
+
+// sets the tag used by untagged allocations (i.e. global new, when TAGGED_ALLOC_REPLACE_GLOBAL_NEW is on) for the lifetime of the scope object.
+// scopes nest, and each task has its own stack of them.
+class TaggedAllocTagScope
+{
+private:
+  char Tag[4];
+  TaggedAllocTagScope* Previous;
+
+  static TaggedAllocTagScope*& Top()
   {
-    capturedCopyOK = true;
-    memcpy(allocationTableCopy, AllocationTable, tableBufferSize);
+    static thread_local TaggedAllocTagScope* top = nullptr;
+    return top;
   }
-  xSemaphoreGiveRecursive(AllocationTableMutex);
 
-  if (!capturedCopyOK)
+public:
+  explicit TaggedAllocTagScope(const char tag[4])
   {
-    Serial.println("Could not capture allocation table due to malloc failure.");
-    return;
+    memcpy(Tag, tag, 4);
+    Previous = Top();
+    Top() = this;
   }
 
-  // print summary
-  Serial.print("Allocation count: ");
-  Serial.println(allocCount);
-  Serial.print("Table size: ");
-  Serial.print(tableEntryCount);
-  Serial.print(" (");
-  Serial.print(tableBufferSize);
-  Serial.println(" bytes)");
+  ~TaggedAllocTagScope()
+  {
+    Top() = Previous;
+  }
 
-  // print allocations
-  for (size_t index = 0; index < tableEntryCount; index++)
+  TaggedAllocTagScope(const TaggedAllocTagScope&) = delete;
+  TaggedAllocTagScope& operator=(const TaggedAllocTagScope&) = delete;
+
+  // gets the tag of the innermost scope on the current task, or the default tag if there isn't one.
+  static void GetCurrentTag(char tag[4])
   {
-    TaggedAllocationDescriptor alloc = allocationTableCopy[index];
-    if (TAGGED_ALLOC_IS_VALID(alloc))
-    {
-      Serial.print("Tag: ");
-      Serial.write((uint8_t*)alloc.Tag, 4);
-      Serial.print(", Size: ");
-      Serial.print(alloc.Size);
-#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
-      Serial.print(", Time: ");
-      Serial.print(alloc.Time / 1000.0);
-#endif
-      Serial.print(", Pointer: 0x");
-      uint32_t objectPtrValue = (uint32_t)alloc.Object;
-      Serial.print(objectPtrValue, HEX);
-      Serial.println("");
-    }
+    const TaggedAllocTagScope* top = Top();
+    memcpy(tag, top ? top->Tag : TAGGED_ALLOC_DEFAULT_TAG, 4);
   }
-  
-  free(allocationTableCopy);
-}
+};
 
 
-/*********************
- * Private functions *
- *********************/
+// marks the current task as being inside the tracker, so that anything it allocates while in there (e.g. in a failure handler)
+// goes straight to the heap rather than recursing back into the tracker.
+class TaggedAllocRecursionGuard
+{
+private:
+  static uint32_t& Depth()
+  {
+    static thread_local uint32_t depth = 0;
+    return depth;
+  }
+
+public:
+  TaggedAllocRecursionGuard() { Depth()++; }
+  ~TaggedAllocRecursionGuard() { Depth()--; }
+
+  TaggedAllocRecursionGuard(const TaggedAllocRecursionGuard&) = delete;
+  TaggedAllocRecursionGuard& operator=(const TaggedAllocRecursionGuard&) = delete;
+
+  // is the current task already inside the tracker?
+  static bool Active() { return Depth() > 0; }
+};
+
+
+/**********
+ * Output *
+ **********/
 
-bool TaggedAlloc::GetFirstEmptySlot(size_t* index)
+// formats a line into a buffer on the stack and writes it to out with a single write() call.
+// that's much quicker than lots of little print() calls on a slow sink. anything past TAGGED_ALLOC_PRINT_LINE_SIZE is cut off.
+inline size_t TaggedAllocPrintLine(Print& out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+inline size_t TaggedAllocPrintLine(Print& out, const char* format, ...)
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  bool result = false;
-  for (size_t n = 0; n < AllocationTableSize; n++)
+  char line[TAGGED_ALLOC_PRINT_LINE_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(line, sizeof(line), format, args);
+  va_end(args);
+  if (length <= 0)
   {
-    if (!TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
-    {
-      *index = n;
-      result = true;
-      break;
-    }
+    return 0;
   }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
-  return result;
+  if ((size_t)length >= sizeof(line))
+  {
+    length = sizeof(line) - 1;
+  }
+  return out.write(reinterpret_cast<const uint8_t*>(line), (size_t)length);
 }
 
 
-/*bool TaggedAlloc::GetNextValidEntry(size_t start, size_t* index)
-{
+/*
+ * Binary stats format (version 1), as written by WriteBinaryStats().
+ * It only covers the allocations themselves, plus the count and total size; the rest of what PrintStats() shows (table size, overflows, failures,
+ * budgets, pools, reclaimers, the zero pool and compaction) isn't included. a record is typically around 9 bytes against about 60 for a line of
+ * PrintStats() text, so it's roughly a seventh of the size. Everything is little-endian.
+ *
+ * varint: unsigned LEB128, i.e. 7 bits per byte, least significant group first, with the top bit set on every byte but the last.
+ * zigzag: a signed value mapped to unsigned (0, -1, 1, -2, ... -> 0, 1, 2, 3, ...) so that small negative numbers stay short, then written as a varint.
+ *
+ * header:
+ *   4 bytes   magic, "TAST"
+ *   1 byte    version, currently 1. a parser should refuse versions it doesn't know.
+ *   1 byte    flags. bit 0 is set if records have a time field. other bits are reserved and are 0.
+ *   varint    allocation count when the stats were taken (the end marker has the count actually written)
+ *   varint    total size of the allocations, in bytes
+ *   varint    millis() when the stats were taken
+ * tag dictionary:
+ *   varint    number of tags, n
+ *   n*4 bytes the tags, 4 chars each
+ * records, one per allocation:
+ *   varint    tag reference: 0 is the end marker, 1 means the tag follows inline (4 bytes), and k+2 means tag k in the dictionary
+ *   4 bytes   the tag, only if the tag reference was 1
+ *   varint    size in bytes
+ *   zigzag    pointer, minus the previous record's pointer (the first record is relative to 0)
+ *   zigzag    time in ms, minus the previous record's time (the first is relative to 0). only present if flag bit 0 is set.
+ * end marker:
+ *   varint    0
+ *   varint    number of records written
+ */
+
+// current version of the binary stats format
+static const uint8_t TaggedAllocBinaryStatsVersion = 1;
+
+// the longest a single record can be: a tag reference, an inline tag, and three 64-bit varints
+static const size_t TaggedAllocBinaryRecordMaxSize = 1 + 4 + 10 + 10 + 10;
+
+// writes value to buffer as a varint. returns the number of bytes written, which is at most 10.
+inline size_t TaggedAllocEncodeVarint(uint8_t* buffer, uint64_t value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    buffer[length++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t)value;
+  return length;
+}
+
+
+// maps a signed value to an unsigned one for TaggedAllocEncodeVarint(), keeping small negative values small
+inline uint64_t TaggedAllocZigZag(int64_t value)
+{
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+
+// adapts a stdio FILE* to Print, so that stats can be written to a file (or stdout) on hosts that have one.
+class TaggedAllocFilePrint : public Print
+{
+private:
+  FILE* File;
+
+public:
+  explicit TaggedAllocFilePrint(FILE* file) : File(file) { assert(file); }
+
+  size_t write(uint8_t c) override
+  {
+    return fwrite(&c, 1, 1, File);
+  }
+
+  size_t write(const uint8_t* buffer, size_t size) override
+  {
+    return fwrite(buffer, 1, size, File);
+  }
+};
+
+
+/***************************
+ * Descriptor and registry *
+ ***************************/
+
+// descriptor struct for allocations. this is shared between all instances.
+struct TaggedAllocationDescriptor
+{
+  void* Object;
+  size_t Size;
+  char Tag[4];
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  uint32_t Time;
+#endif
+};
+
+
+// each instance adds one of these to the registry when it's initialised, so that stats can be gathered across all of them.
+struct TaggedAllocInstanceInfo
+{
+  const char* Name;
+  size_t (*GetAllocationCount)();
+  size_t (*GetAllocationTableSize)();
+  size_t (*GetTotalSize)();
+  void (*PrintStats)(Print& out);
+  TaggedAllocInstanceInfo* Next;
+};
+
+
+// aggregate view across every initialised instance.
+// like Init(), registration isn't protected against two instances being initialised at the same moment on different cores, so initialise instances in your setup function.
+class TaggedAllocRegistry
+{
+private:
+  static TaggedAllocInstanceInfo*& Head()
+  {
+    static TaggedAllocInstanceInfo* head = nullptr;
+    return head;
+  }
+
+public:
+  static void Register(TaggedAllocInstanceInfo* info);
+
+  static size_t GetInstanceCount();
+
+  static size_t GetAllocationCount();
+
+  static size_t GetAllocationTableSize();
+
+  static size_t GetTotalSize();
+
+  static void PrintStats(Print& out = Serial);
+
+  // walk the registered instances. returns nullptr when there are none left.
+  static const TaggedAllocInstanceInfo* First() { return Head(); }
+  static const TaggedAllocInstanceInfo* Next(const TaggedAllocInstanceInfo* info) { return info->Next; }
+};
+
+
+/********************
+ * Class definition *
+ ********************/
+
+template<typename Config>
+class TaggedAllocT
+{  
+  static_assert((Config::MaxTags & (Config::MaxTags - 1)) == 0, "MaxTags must be a power of two");
+  static_assert((Config::TraceSize & (Config::TraceSize - 1)) == 0, "TraceSize must be a power of two");
+  // the change log is indexed by generation, which wraps at 2^32, so the ring has to divide that evenly to stay in step across the wrap
+  static_assert((Config::ChangeLogSize & (Config::ChangeLogSize - 1)) == 0, "ChangeLogSize must be a power of two");
+  static_assert(Config::LeakEpochs == 0 || (Config::LeakGrowthEpochs <= Config::LeakWindowEpochs && Config::LeakWindowEpochs <= 32),
+    "LeakWindowEpochs must be between LeakGrowthEpochs and 32");
+
+private:
+  // internal per-tag settings. these live in a small fixed-size hash table keyed on the tag.
+  struct TagInfo
+  {
+    char Tag[4];
+    bool InUse;
+    // should Allocate/AllocateArray zero memory for this tag? defaults to true.
+    bool ZeroOnAllocate;
+    // number of allocations with this tag that have failed
+    uint32_t FailureCount;
+    // bytes and allocations currently tracked with this tag. these are kept up to date on every insert and remove, so reading them is O(1).
+    size_t CurrentBytes;
+    size_t CurrentCount;
+    // budget limits (0 means unlimited), what to do when they'd be exceeded, and how long BudgetBlock waits for
+    size_t MaxBytes;
+    size_t MaxCount;
+    uint8_t BudgetPolicy;
+    TickType_t BudgetTimeout;
+    // number of allocations that would have gone over budget
+    uint32_t BreachCount;
+    // bytes with this tag that were freed by reclaim callbacks
+    size_t ReclaimedBytes;
+  };
+
+  // a tag's leak watch state. this is kept in a table alongside the tag table (at the same index), so that it costs nothing when it's off.
+  struct TagLeakInfo
+  {
+    // live allocations with this tag by the epoch they were made in (indexed by epoch % LeakEpochs), and the ones older than that
+    size_t AgeBuckets[Config::LeakEpochs > 0 ? Config::LeakEpochs : 1];
+    size_t OldCount;
+    // the old count when the watch last moved on
+    size_t LastOldCount;
+    // which of the recent epochs the old count went up in, and which it went down in. bit 0 is the latest epoch.
+    uint32_t GrowthHistory;
+    uint32_t DropHistory;
+  };
+
+  // flags passed through to AllocateInternal to control how an allocation is performed.
+  enum AllocFlags : uint8_t
+  {
+    // use the per-tag default behaviour
+    AllocFlagsNone = 0,
+    // never zero the memory, regardless of the per-tag setting
+    AllocNoZero = 1 << 0,
+    // return nullptr on failure, rather than applying the assertion failure policy
+    AllocNoPanic = 1 << 1,
+    // never wait for budget headroom, even if the tag's policy is BudgetBlock (used where the lock is already held)
+    AllocNoBlock = 1 << 2,
+  };
+
+  // the malloc() wrappers need the flag-taking internals
+  friend class TaggedAllocMallocWrap;
+
+public:
+  // reclaim callback. this should free up whatever it can (e.g. by dropping caches), ideally at least bytesNeeded.
+  // bytesNeeded is the size of the allocation that failed, or how far past its watermark the heap is when a watermark triggered it.
+  typedef void (*ReclaimCallback)(size_t bytesNeeded);
+
+private:
+  // a registered reclaim callback
+  struct Reclaimer
+  {
+    char Tag[4];
+    ReclaimCallback Callback;
+    int Priority;
+    // run when the total tracked bytes reaches this, or free heap drops to this (0 means no watermark)
+    size_t TrackedHighWatermark;
+    size_t FreeHeapLowWatermark;
+    // set while a watermark is crossed, so the callback runs once per crossing rather than on every allocation
+    bool UnderPressure;
+    uint32_t InvocationCount;
+    size_t ReleasedBytes;
+  };
+
+  // a single size class in the pre-zeroed block pool.
+  struct ZeroPoolClass
+  {
+    // size of the blocks in this class. 0 means the class is unused.
+    size_t BlockSize;
+    // number of valid entries in Ready
+    size_t ReadyCount;
+    // zeroed blocks, ready to be handed out
+    void* Ready[Config::ZeroPoolDepth];
+    uint32_t Hits;
+    uint32_t Misses;
+    // set when the class first drops below full, so we can measure how long the refill task takes to catch up
+    bool Drained;
+    uint32_t DrainedTime;
+    uint32_t LastRefillLag;
+    uint32_t MaxRefillLag;
+  };
+
+  // this is set when Init() is called, to signify that we have initialised OK.
+  static bool InitOK;
+  // number of active allocations that are present in the table.
+  static size_t AllocationCount;
+  // the size (in entries, not bytes) of the allocation table.
+  static size_t AllocationTableSize;
+  // the allocation table. this stores the allocation descriptors.
+  static TaggedAllocationDescriptor* AllocationTable;
+  // mutex for the allocation table.
+  static SemaphoreHandle_t AllocationTableMutex;
+#ifdef TAGGED_ALLOC_STATIC_MUTEX
+  static StaticSemaphore_t AllocationTableMutexStatic;
+#endif
+  // backing storage for the allocation table, in fixed-capacity mode. (this is a single unused entry when the table is on the heap.)
+  static TaggedAllocationDescriptor StaticAllocationTable[Config::StaticTableSize > 0 ? Config::StaticTableSize : 1];
+  // open-addressed hash index from object pointer to table slot, so that lookups by pointer don't have to scan the table.
+  // each entry is a slot number plus one (0 means empty). it's always at least twice the size of the table, so it stays at most half full.
+  static size_t* PointerIndex;
+  static size_t PointerIndexSize;
+  // backing storage for the index, in fixed-capacity mode
+  static size_t StaticPointerIndex[Config::StaticTableSize > 0 ? TaggedAllocCeilPowerOfTwo(Config::StaticTableSize * 2) : 1];
+  // table slots sorted by object address, for looking up which allocation an address falls inside. only kept when Config::AddressIndex is set.
+  // the capacity is at least the table size; it can lag behind a shrink if the heap won't give the memory back.
+  static size_t* AddressIndex;
+  static size_t AddressIndexCount;
+  static size_t AddressIndexCapacity;
+  static size_t StaticAddressIndex[(Config::AddressIndex && Config::StaticTableSize > 0) ? Config::StaticTableSize : 1];
+  // number of allocations that were refused because the fixed-capacity table was full.
+  static uint32_t TableOverflowCount;
+  // the current leak watch epoch, and the number of live allocations whose tag didn't fit in the tag table (so aren't in any age bucket)
+  static uint32_t LeakEpoch;
+  static size_t UnbucketedCount;
+  // leak watch state for each entry in the tag table (this is a single unused entry when the leak watch is off)
+  static TagLeakInfo TagLeakTable[Config::LeakEpochs > 0 ? Config::MaxTags : 1];
+  // sum of the sizes of every tracked allocation, kept up to date alongside the per-tag totals.
+  static size_t TotalSize;
+  // bumped on every change to the contents of the table. it's only changed with the lock held, but can be read without it.
+  static std::atomic<uint32_t> ChangeGeneration;
+  // bumped whenever entries move to different slots in the table (i.e. when it's defragmented), so that cursors know their position is stale.
+  static uint32_t LayoutGeneration;
+  // per-tag settings table.
+  static TagInfo TagInfoTable[Config::MaxTags];
+  // number of entries in use in the tag table, and how many of them can be created automatically (the rest are kept for configured tags)
+  static size_t TagInfoCount;
+  static const size_t AutoTagLimit = Config::MaxTags - Config::MaxTags / 4;
+  // reclaim callbacks, sorted by descending priority, and whether one is currently running (so that a failure inside a callback doesn't recurse).
+  // the count is only changed with the lock held, but CheckMemoryPressure() reads it without the lock to skip the work when there are none.
+  static Reclaimer ReclaimerTable[Config::MaxReclaimers];
+  static std::atomic<size_t> ReclaimerCount;
+  static bool Reclaiming;
+  // this instance's entry in the registry
+  static TaggedAllocInstanceInfo InstanceInfo;
+  // pre-zeroed block pool, and the idle-priority task that refills it. (this is a single unused class when the pool is off.)
+  static ZeroPoolClass ZeroPool[Config::ZeroPoolClasses > 0 ? Config::ZeroPoolClasses : 1];
+  static TaskHandle_t ZeroPoolTaskHandle;
+
+
+  // this sets the allocation time using millis()
+  // you can turn the time tracking off by defining TAGGED_ALLOC_NO_TIME_TRACKING
+  static inline void SetTaggedAllocationDescriptorTime(TaggedAllocationDescriptor* allocation) __attribute__((always_inline))
+  {
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+    allocation->Time = millis();
+#endif
+  }
+
+  // home position of a pointer in the pointer index. blocks are aligned, so the low bits are mixed with the high bits first.
+  static inline size_t HashPointer(const void* objectPointer) __attribute__((always_inline))
+  {
+    uint32_t hash = (uint32_t)(uintptr_t)objectPointer;
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3b;
+    hash ^= hash >> 16;
+    return hash & (PointerIndexSize - 1);
+  }
+  
+  static bool IsAllocationTableFragmented(size_t start, size_t* firstEmptyIndex, size_t* firstValidIndex);
+  static void DefragAllocationTable();
+  static bool GetFirstEmptySlot(size_t* index);
+  static bool ResizeAllocationTable(size_t entryCount);
+  static bool InsertAllocation(TaggedAllocationDescriptor ta);
+  static bool RemoveAllocation(void* objectPointer);
+  static bool ReserveTableCapacity(size_t entryCount);
+  static void ShrinkAllocationTableIfSparse();
+  static bool FindAllocation(void* objectPointer, size_t* index);
+  static void InsertPointerIndex(size_t slot);
+  static void RemovePointerIndex(size_t slot);
+  static void RebuildPointerIndex();
+  static size_t FindAddressIndexPosition(const void* address);
+  static void InsertAddressIndex(size_t slot);
+  static void RemoveAddressIndex(size_t slot);
+  static void MoveAddressIndex(size_t fromSlot, size_t toSlot);
+  static void PrintAllocation(Print& out, const TaggedAllocationDescriptor& alloc);
+  static void* ReallocateBytes(void* objectPointer, size_t newSize, uint8_t flags);
+  static TagInfo* GetTagInfo(const char tag[4], bool create, bool configured = false);
+  static TagInfo* GetConfiguredTagInfo(const char tag[4]);
+  static void AdvanceLeakEpochs();
+  static void AdjustAgeBuckets(const TaggedAllocationDescriptor& allocation, ptrdiff_t count);
+  static TagLeakInfo* GetTagLeakInfo(const TagInfo* info) { return &TagLeakTable[Config::LeakEpochs > 0 ? (info - TagInfoTable) : 0]; }
+  static bool IsLeakSuspect(const TagLeakInfo& leak, uint32_t* growthEpochs);
+  static bool ShouldZeroTag(const char tag[4]);
+  static void AdjustTagUsage(const char tag[4], ptrdiff_t bytes, ptrdiff_t count);
+  static bool ReserveTagBudget(char tag[4], size_t size, size_t count, uint8_t flags);
+  static void InvokeReclaimer(size_t index, size_t bytesNeeded);
+  static bool RunReclaimers(size_t bytesNeeded);
+  static void CheckMemoryPressure();
+  static bool HandleAllocationFailure(size_t size, char tag[4], uint8_t flags, size_t attempt);
+  
+  static void* AllocateBlock(size_t count, size_t elementSize, bool zero, size_t* blockSize);
+  static void* AllocateBytes(size_t count, size_t elementSize, char tag[4], uint8_t flags);
+  static bool AllocateBatchBytes(void** objects, const size_t* sizes, size_t uniformSize, size_t count, char tag[4], uint8_t flags);
+
+  static void* TakeZeroPoolBlock(size_t* size);
+  static void RefillZeroPool();
+  static void ZeroPoolTask(void* parameter);
+
+  template<typename T>
+  static T* AllocateInternal(size_t count, char tag[4], uint8_t flags);
+
+public:
+  // what to do when an allocation fails
+  enum FailurePolicy
+  {
+    // throw an assertion failure (the default)
+    FailAssert,
+    // return nullptr
+    FailReturnNull,
+    // call the failure handler and retry if it returns true. if it returns false (or the retry limit is hit), return nullptr.
+    FailCallHandler,
+  };
+
+  // failure handler callback. this gets the size and tag of the failed allocation, and should return true if it freed up some memory and the allocation should be retried.
+  typedef bool (*FailureHandler)(size_t size, const char tag[4]);
+
+  // what to do when an allocation would take a tag over its budget
+  enum BudgetPolicy : uint8_t
+  {
+    // fail the allocation. this goes through the failure policy, exactly as if the heap had run out.
+    BudgetFail,
+    // wait (up to the budget's timeout) for allocations with the tag to be freed, then fail if there's still no room
+    BudgetBlock,
+    // let the allocation through, but count the breach, and print a warning on the 1st, 2nd, 4th, 8th... breach
+    BudgetLogAndAllow,
+  };
+
+  // results for a single reclaim callback, for tuning
+  struct ReclaimStats
+  {
+    char Tag[4];
+    int Priority;
+    uint32_t InvocationCount;
+    // total drop in the tag's tracked bytes across all invocations
+    size_t ReleasedBytes;
+  };
+
+  // a place in a walk through the table with NextAllocations(). zero-initialise it to start from the beginning.
+  struct AllocationCursor
+  {
+    size_t Position;
+    // the layout generation the position is for, and the last allocation handed out.
+    // if the table is defragmented between chunks, the walk carries on from wherever that allocation ended up.
+    uint32_t LayoutGeneration;
+    void* LastObject;
+    // set if the table was defragmented and the last allocation was gone too, so our place couldn't be found again exactly.
+    // the walk still carries on, but some allocations may have been skipped.
+    bool Incomplete;
+  };
+
+  // what happened to an allocation, in the change log
+  enum ChangeKind : uint8_t
+  {
+    ChangeAdded,
+    ChangeRemoved,
+  };
+
+  // a single entry in the change log. a resize (or a move) shows up as the old descriptor being removed, then the new one being added.
+  struct TableChange
+  {
+    uint32_t Generation;
+    ChangeKind Kind;
+    TaggedAllocationDescriptor Allocation;
+  };
+
+  // result of SnapshotSince()
+  enum DeltaResult
+  {
+    // every change since the generation was returned
+    DeltaOk,
+    // the buffer filled up, so call again from the returned generation to get the rest
+    DeltaMore,
+    // the changes since the generation are no longer in the log, so a full snapshot is needed
+    DeltaOverrun,
+  };
+
+  // what happened, in a trace event
+  enum TraceOp : uint8_t
+  {
+    TraceAllocate,
+    TraceFree,
+    // an allocation that failed for good (after any retries), with the size and tag that were asked for. Object is nullptr.
+    TraceAllocateFailed,
+    // Free() (or FreeBatch()) of a pointer that isn't in the table. Size is 0 and the tag is blank.
+    TraceFreeUntracked,
+  };
+
+  // a single event in the allocation trace. a resize (or a move) shows up as a free of the old block, then an allocation of the new one.
+  // adds and removes are written as part of the table change, so with the lock held (writing an event doesn't take the lock itself, and is
+  // only a few stores). failed allocations and untracked frees are written without it.
+  struct TraceEvent
+  {
+    // micros() when it happened, and which task did it
+    uint32_t Time;
+    TaskHandle_t Task;
+    void* Object;
+    uint32_t Size;
+    char Tag[4];
+    TraceOp Op;
+  };
+
+  // a tag that the leak watch thinks is leaking
+  struct LeakSuspect
+  {
+    char Tag[4];
+    // number of allocations with the tag that are older than the leak watch window, and how many of the last LeakWindowEpochs epochs that went up in
+    size_t OldCount;
+    uint32_t GrowthEpochs;
+  };
+
+  // an immutable copy of the table, published for readers that mustn't hold up allocations (see AcquirePublishedView())
+  struct PublishedView
+  {
+    // the change generation the copy was taken at (see GetChangeGeneration()), and when it was taken, in ms
+    uint32_t Generation;
+    uint32_t Time;
+    size_t AllocationCount;
+    size_t TotalSize;
+    // number of descriptors in Allocations. if the table had more than would fit, Truncated is set and the rest are missing.
+    size_t Count;
+    bool Truncated;
+    TaggedAllocationDescriptor Allocations[Config::PublishedViewSize > 0 ? Config::PublishedViewSize : 1];
+  };
+
+  // current usage and budget for a single tag
+  struct TagBudgetStats
+  {
+    size_t CurrentBytes;
+    size_t CurrentCount;
+    // 0 means unlimited
+    size_t MaxBytes;
+    size_t MaxCount;
+    BudgetPolicy Policy;
+    // number of allocations that would have gone over budget
+    uint32_t BreachCount;
+  };
+
+private:
+  // global failure policy, and the handler used with FailCallHandler
+  static FailurePolicy AllocationFailurePolicy;
+  static FailureHandler AllocationFailureHandler;
+
+public:
+  // Initialise. This must be called at least once before any allocations can be performed.
+  static void Init()
+  {
+    /*  Note that this is technically a race condition here, where if two calls are made to Init() at the same time (by two different cores) 
+     *  and no call to Init() has been made before, we could end up initialising twice and making a mess of things.
+     *  You can solve this by calling Init() in your setup function, rather than trying to lazily initialise in tasks or something weird.
+     */
+    if (InitOK)
+    {
+      return;
+    }
+
+    // normally I'd use static allocation here, but arduino-esp32 didn't include the static implementations.
+    // see: https://github.com/espressif/arduino-esp32/issues/4851
+#ifdef TAGGED_ALLOC_STATIC_MUTEX
+    AllocationTableMutex = xSemaphoreCreateRecursiveMutexStatic(&AllocationTableMutexStatic);
+#else
+    AllocationTableMutex = xSemaphoreCreateRecursiveMutex();
+#endif
+    assert(AllocationTableMutex);
+
+    if (Config::StaticTableSize > 0)
+    {
+      // fixed-capacity mode. the static storage is zero-initialised already.
+      AllocationTable = StaticAllocationTable;
+      AllocationTableSize = Config::StaticTableSize;
+      PointerIndex = StaticPointerIndex;
+      PointerIndexSize = TaggedAllocCeilPowerOfTwo(Config::StaticTableSize * 2);
+      if (Config::AddressIndex)
+      {
+        AddressIndex = StaticAddressIndex;
+        AddressIndexCapacity = Config::StaticTableSize;
+      }
+    }
+    else
+    {
+      size_t allocationBufferSize = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
+      AllocationTable = static_cast<TaggedAllocationDescriptor*>(TAGGED_ALLOC_MALLOC(allocationBufferSize));
+      assert(AllocationTable);
+      // zero the buffer! this is critical and forgetting to do so caused a bug previously :(
+      memset(AllocationTable, 0, allocationBufferSize);
+      PointerIndexSize = TaggedAllocCeilPowerOfTwo(AllocationTableSize * 2);
+      PointerIndex = static_cast<size_t*>(TAGGED_ALLOC_CALLOC(PointerIndexSize, sizeof(size_t)));
+      assert(PointerIndex);
+      if (Config::AddressIndex)
+      {
+        AddressIndex = static_cast<size_t*>(TAGGED_ALLOC_MALLOC(AllocationTableSize * sizeof(size_t)));
+        assert(AddressIndex);
+        AddressIndexCapacity = AllocationTableSize;
+      }
+    }
+
+    LeakEpoch = millis() / Config::LeakEpochMs;
+    InitOK = true;
+
+    // start readers off with an empty view, rather than one that claims to be from boot
+    PublishView();
+
+    InstanceInfo.Name = Config::Name();
+    TaggedAllocRegistry::Register(&InstanceInfo);
+    
+    assert(heap_caps_check_integrity_all(true));
+  }
+  
+  static bool IsInitialised();
+
+  static size_t GetAllocationCount();
+
+  static size_t GetAllocationTableSize();
+
+  static size_t GetTotalSize();
+  
+  static void PrintStats(Print& out = Serial);
+
+  static size_t WriteBinaryStats(Print& out);
+
+  static bool Snapshot(TaggedAllocationDescriptor* buffer, size_t capacity, size_t* written, size_t* cursor = nullptr);
+
+  static bool NextAllocations(AllocationCursor* cursor, TaggedAllocationDescriptor* buffer, size_t capacity, size_t* written);
+
+  template<typename Visitor>
+  static bool ForEachAllocation(Visitor visitor);
+
+  static uint32_t GetChangeGeneration();
+
+  static size_t DrainTrace(TraceEvent* events, size_t capacity);
+
+  static uint32_t GetTraceDroppedCount();
+
+  static DeltaResult SnapshotSince(uint32_t generation, TableChange* buffer, size_t capacity, size_t* written, uint32_t* nextGeneration);
+
+  static bool PublishView();
+
+  static const PublishedView* AcquirePublishedView();
+
+  static void ReleasePublishedView(const PublishedView* view);
+
+  template<typename T>
+  static T* Allocate(char tag[4]);
+
+  template<typename T>
+  static T* AllocateArray(size_t count, char tag[4]);
+
+  template<typename T>
+  static T* AllocateUninitialized(char tag[4]);
+
+  template<typename T>
+  static T* AllocateArrayUninitialized(size_t count, char tag[4]);
+
+  static void SetTagZeroing(char tag[4], bool zero);
+
+  template<typename T>
+  static T* TryAllocate(char tag[4]);
+
+  template<typename T>
+  static T* TryAllocateArray(size_t count, char tag[4]);
+
+  template<typename T>
+  static T* TryAllocateArrayUninitialized(size_t count, char tag[4]);
+
+  static bool Track(void* object, size_t size, char tag[4]);
+
+  static bool Untrack(void* object);
+
+  static bool IsTracked(const void* object);
+
+  static size_t GetAllocationSize(const void* object);
+
+  static bool GetAllocationTag(const void* object, char tag[4]);
+
+  static bool FindContaining(const void* address, TaggedAllocationDescriptor* allocation);
+
+  static size_t FindInRange(const void* start, const void* end, TaggedAllocationDescriptor* allocations, size_t capacity);
+
+  static void SetFailurePolicy(FailurePolicy policy, FailureHandler handler = nullptr);
+
+  static uint32_t GetTagFailureCount(char tag[4]);
+
+  static size_t FindLongLived(uint32_t minAgeMs, size_t perTagLimit, TaggedAllocationDescriptor* allocations, size_t capacity);
+
+  static size_t LeakWatchTick(LeakSuspect* suspects = nullptr, size_t capacity = 0);
+
+  static uint32_t GetTableOverflowCount();
+
+  static void SetTagBudget(char tag[4], size_t maxBytes, size_t maxCount, BudgetPolicy policy = BudgetFail, TickType_t timeout = 0);
+
+  static bool GetTagBudgetStats(char tag[4], TagBudgetStats* stats);
+
+  static size_t GetTagHeadroom(char tag[4]);
+
+  static bool RegisterReclaimer(char tag[4], ReclaimCallback callback, int priority, size_t trackedHighWatermark = 0, size_t freeHeapLowWatermark = 0);
+
+  static bool GetReclaimStats(size_t index, ReclaimStats* stats);
+
+  static size_t GetTagReclaimedBytes(char tag[4]);
+
+  // statistics for a single size class of the pre-zeroed block pool
+  struct ZeroPoolStats
+  {
+    size_t BlockSize;
+    size_t ReadyCount;
+    // zeroed allocations that were served from the pool
+    uint32_t Hits;
+    // zeroed allocations that fitted in this class but found it empty, and fell back to calloc()
+    uint32_t Misses;
+    // time (ms) the refill task took to bring the class back to full, the last time it did so, and the worst case so far
+    uint32_t LastRefillLag;
+    uint32_t MaxRefillLag;
+  };
+
+  static void ConfigureZeroPool(const size_t* blockSizes, size_t classCount);
+
+  static bool GetZeroPoolStats(size_t classIndex, ZeroPoolStats* stats);
+
+  static void DrainZeroPool();
+
+  template<typename T>
+  static void Free(T* object);
+
+  template<typename T>
+  static T* Reallocate(T* object, size_t newCount);
+
+  template<typename T>
+  static bool AllocateBatch(T** objects, size_t count, char tag[4]);
+
+  static bool AllocateBatch(void** objects, const size_t* sizes, size_t count, char tag[4]);
+
+  template<typename T>
+  static void FreeBatch(T** objects, size_t count);
+
+  static void FreeBatch(void** objects, size_t count);
+
+  template<typename T, typename... Args>
+  static T* New(char tag[4], Args&&... args);
+
+  template<typename T>
+  static T* NewArray(size_t count, char tag[4]);
+
+  template<typename T>
+  static void Delete(T* object);
+
+  template<typename T>
+  static void DeleteArray(T* object);
+
+  // a reference to a movable allocation. the tracker owns the actual pointer, so that it can move the block while it isn't pinned.
+  // handles are small values that can be copied around freely. a default-constructed handle is invalid.
+  template<typename T>
+  class Handle
+  {
+    friend class TaggedAllocT;
+
+  private:
+    uint16_t Index;
+    // bumped every time the handle slot is reused, so that a stale handle can't reach someone else's block. 0 means invalid.
+    uint16_t Generation;
+
+    Handle(uint16_t index, uint16_t generation) : Index(index), Generation(generation) { }
+
+  public:
+    Handle() : Index(0), Generation(0) { }
+
+    bool IsValid() const { return Generation != 0; }
+  };
+
+  // results of a compaction pass
+  struct CompactionStats
+  {
+    // number of blocks that were moved, and how many bytes that was
+    size_t MovedCount;
+    size_t MovedBytes;
+    // largest free block in the heap before and after compacting, which is what decides whether a big allocation will fit
+    size_t LargestFreeBefore;
+    size_t LargestFreeAfter;
+  };
+
+  template<typename T>
+  static Handle<T> AllocateMovable(size_t count, char tag[4]);
+
+  template<typename T>
+  static T* Pin(Handle<T> handle);
+
+  template<typename T>
+  static void Unpin(Handle<T> handle);
+
+  template<typename T>
+  static void FreeMovable(Handle<T>& handle);
+
+  static CompactionStats Compact();
+
+  // a cache of fixed-size nodes, carved out of chunks that are each tracked as a single allocation with the given tag.
+  // freed nodes go on a free list for reuse, and the chunks are kept for the lifetime of the program.
+  // this is the fast path that TaggedStdAllocator uses for node-based containers.
+  template<size_t NodeSize, uint32_t PackedTag>
+  class NodeCache
+  {
+    static_assert(NodeSize >= sizeof(void*), "nodes must be big enough to hold the free list link");
+
+  private:
+    static void* FreeList;
+
+  public:
+    static void* Allocate();
+    static void Free(void* node);
+  };
+
+  // the parts of a pool that don't depend on the object type, so that PrintStats() can walk all of the pools.
+  class PoolBase
+  {
+    friend class TaggedAllocT;
+
+  protected:
+    // chunks are linked together through a header at the start of each one
+    struct ChunkHeader
+    {
+      ChunkHeader* Next;
+      // only used while shrinking
+      size_t FreeObjects;
+    };
+
+    char Tag[4];
+    size_t ObjectsPerChunk;
+    size_t LiveCount;
+    size_t Capacity;
+    size_t PeakCount;
+    // the most live objects since the pool was last idle, and a peak that halves each time the pool goes idle without reaching it again.
+    // the pool keeps enough chunks for RecentPeak when it goes idle, so a burst that repeats doesn't free and re-malloc its chunks every time
+    size_t BurstPeak;
+    size_t RecentPeak;
+    size_t ChunkCount;
+    ChunkHeader* Chunks;
+    void* FreeList;
+    bool Registered;
+    PoolBase* Next;
+
+    PoolBase(const char tag[4], size_t objectsPerChunk);
+
+    void* AllocateObject(size_t objectSize, size_t headerSize);
+    void FreeObject(void* object, size_t objectSize, size_t headerSize);
+    void ShrinkChunks(size_t objectSize, size_t headerSize, size_t keepChunks);
+    void FreeAllChunks();
+
+  public:
+    PoolBase(const PoolBase&) = delete;
+    PoolBase& operator=(const PoolBase&) = delete;
+
+    size_t GetLiveCount();
+    size_t GetCapacity();
+    size_t GetPeakCount();
+  };
+
+  // a recycler for objects of type T. freed objects go on an intrusive free list and get reused, so there's no malloc/free or table update per object.
+  // objects are carved out of chunks, each of which is a single tracked allocation with the pool's tag. the pool grows a chunk at a time,
+  // and gives back chunks beyond its recent peak when it goes idle (i.e. has no live objects). Shrink() gives back every unused chunk straight away.
+  template<typename T>
+  class Pool : public PoolBase
+  {
+  private:
+    // each object slot must be able to hold the free list link, and be aligned for both T and the link
+    static const size_t ObjectAlign = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+    static const size_t ObjectSize = ((sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)) + ObjectAlign - 1) / ObjectAlign * ObjectAlign;
+    static const size_t HeaderSize = (sizeof(typename PoolBase::ChunkHeader) + ObjectAlign - 1) / ObjectAlign * ObjectAlign;
+
+  public:
+    Pool(const char tag[4], size_t objectsPerChunk = TAGGED_ALLOC_POOL_OBJECTS_PER_CHUNK) : PoolBase(tag, objectsPerChunk) { }
+    ~Pool();
+
+    T* Allocate();
+    void Free(T* object);
+
+    template<typename... Args>
+    T* New(Args&&... args);
+    void Delete(T* object);
+
+    void Shrink();
+  };
+
+private:
+  // every pool that has allocated a chunk, for PrintStats()
+  static PoolBase* PoolList;
+
+  // a movable allocation's entry in the handle table
+  struct MovableSlot
+  {
+    // nullptr when the slot is free
+    void* Object;
+    uint16_t Generation;
+    uint16_t PinCount;
+  };
+
+  static MovableSlot MovableTable[Config::MaxMovable > 0 ? Config::MaxMovable : 1];
+  static CompactionStats LastCompaction;
+
+  static bool AddMovable(void* object, uint16_t* index, uint16_t* generation);
+  static MovableSlot* GetMovableSlot(uint16_t index, uint16_t generation);
+  static void* PinMovable(uint16_t index, uint16_t generation);
+  static void UnpinMovable(uint16_t index, uint16_t generation);
+  static void FreeMovableSlot(uint16_t index, uint16_t generation);
+
+  // two copies of the table for lock-free readers: the published one, and a spare that gets refilled and then published in its place.
+  // readers count themselves on the copy they're using, and a copy with readers on it is never refilled.
+  static PublishedView PublishedViews[Config::PublishedViewSize > 0 ? 2 : 1];
+  static std::atomic<uint8_t> PublishedViewIndex;
+  static std::atomic<uint32_t> PublishedViewReaders[2];
+  // ring of the most recent changes, for SnapshotSince(). the change with generation g is at g & (ChangeLogSize - 1).
+  static TableChange ChangeLog[Config::ChangeLogSize > 0 ? Config::ChangeLogSize : 1];
+
+  static void NoteTableChange(ChangeKind kind, const TaggedAllocationDescriptor& allocation);
+  static void RefreshStaleView(uint32_t minAgeMs, bool wait);
+
+  // a slot in the trace ring. Sequence is the event's position plus one once the event is written, and 0 while it's being written.
+  struct TraceSlot
+  {
+    std::atomic<uint32_t> Sequence;
+    TraceEvent Event;
+  };
+  // the trace ring. writers claim a position by bumping TraceHead, so they never wait for each other (or for the reader), and the oldest
+  // events are overwritten when it's full. TraceTail is the next position the reader wants, and only DrainTrace() touches it.
+  static TraceSlot TraceRing[Config::TraceSize > 0 ? Config::TraceSize : 1];
+  static std::atomic<uint32_t> TraceHead;
+  static uint32_t TraceTail;
+  // number of events that were overwritten before they were drained
+  static std::atomic<uint32_t> TraceDropped;
+
+  static void RecordTrace(TraceOp op, const TaggedAllocationDescriptor& allocation);
+};
+
+
+// the default instance. this is the one that everything used before there were multiple instances, and it's configured by the TAGGED_ALLOC_* settings.
+typedef TaggedAllocT<TaggedAllocDefaultConfig> TaggedAlloc;
+
+
+// an allocator for standard containers (std::vector, std::map, etc.) that tracks everything under a tag given at compile time.
+// single nodes up to TAGGED_ALLOC_STD_NODE_MAX_SIZE bytes come from a node cache, so only the cache's chunks show up in the table.
+// if the failure policy returns nullptr then so does allocate(), unless exceptions are enabled, in which case it throws std::bad_alloc.
+template<typename T, uint32_t PackedTag, typename Alloc = TaggedAlloc>
+class TaggedStdAllocator
+{
+private:
+  // node size, rounded up so that every node in a chunk is suitably aligned for both T and the free list link
+  static const size_t NodeAlign = alignof(T) > alignof(void*) ? alignof(T) : alignof(void*);
+  static const size_t NodeSize = ((sizeof(T) > sizeof(void*) ? sizeof(T) : sizeof(void*)) + NodeAlign - 1) / NodeAlign * NodeAlign;
+  static const bool UseNodeCache = (TAGGED_ALLOC_STD_NODE_MAX_SIZE > 0) && (NodeSize <= TAGGED_ALLOC_STD_NODE_MAX_SIZE);
+
+public:
+  typedef T value_type;
+  typedef std::true_type is_always_equal;
+  typedef std::true_type propagate_on_container_move_assignment;
+
+  // needed explicitly, since allocator_traits can't rebind a template with a non-type parameter
+  template<typename U>
+  struct rebind
+  {
+    typedef TaggedStdAllocator<U, PackedTag, Alloc> other;
+  };
+
+  TaggedStdAllocator() noexcept { }
+
+  template<typename U>
+  TaggedStdAllocator(const TaggedStdAllocator<U, PackedTag, Alloc>&) noexcept { }
+
+  T* allocate(size_t count);
+
+  void deallocate(T* object, size_t count);
+};
+
+
+template<typename T, typename U, uint32_t PackedTag, typename Alloc>
+bool operator==(const TaggedStdAllocator<T, PackedTag, Alloc>&, const TaggedStdAllocator<U, PackedTag, Alloc>&) { return true; }
+
+template<typename T, typename U, uint32_t PackedTag, typename Alloc>
+bool operator!=(const TaggedStdAllocator<T, PackedTag, Alloc>&, const TaggedStdAllocator<U, PackedTag, Alloc>&) { return false; }
+
+// an instance with a fixed-capacity table in static storage, e.g. TaggedAllocStatic<4096>.
+template<size_t Capacity, int Id = 0>
+using TaggedAllocStatic = TaggedAllocT<TaggedAllocStaticConfig<Capacity, Id>>;
+
+
+// the implementation behind the --wrap'd malloc()/free()/calloc()/realloc() (see TAGGED_ALLOC_WRAP_MALLOC).
+// wrapped allocations are tracked in the default TaggedAlloc instance.
+class TaggedAllocMallocWrap
+{
+private:
+  // a registered range of code addresses, and the tag to give allocations made from it
+  struct CallerTag
+  {
+    const void* Start;
+    const void* End;
+    char Tag[4];
+  };
+
+  static CallerTag* CallerTags()
+  {
+    static CallerTag callerTags[TAGGED_ALLOC_WRAP_MAX_CALLER_TAGS] = { };
+    return callerTags;
+  }
+
+  static bool ShouldTrack();
+  static void GetCallerTag(const void* caller, char tag[4]);
+
+public:
+  static bool RegisterCallerTag(const void* start, const void* end, const char tag[4]);
+
+  static void* Malloc(size_t size, const void* caller);
+  static void* Calloc(size_t count, size_t size, const void* caller);
+  static void* Realloc(void* object, size_t size, const void* caller);
+  static void Free(void* object);
+};
+
+
+/************************
+ * Static variable init *
+ ************************/
+
+template<typename Config> bool TaggedAllocT<Config>::InitOK = false;
+template<typename Config> size_t TaggedAllocT<Config>::AllocationCount = 0;
+template<typename Config> size_t TaggedAllocT<Config>::AllocationTableSize = Config::InitialTableSize;
+template<typename Config> TaggedAllocationDescriptor* TaggedAllocT<Config>::AllocationTable = nullptr;
+template<typename Config> SemaphoreHandle_t TaggedAllocT<Config>::AllocationTableMutex = nullptr;
+#ifdef TAGGED_ALLOC_STATIC_MUTEX
+template<typename Config> StaticSemaphore_t TaggedAllocT<Config>::AllocationTableMutexStatic;
+#endif
+template<typename Config> TaggedAllocationDescriptor TaggedAllocT<Config>::StaticAllocationTable[Config::StaticTableSize > 0 ? Config::StaticTableSize : 1] = { };
+template<typename Config> size_t* TaggedAllocT<Config>::PointerIndex = nullptr;
+template<typename Config> size_t TaggedAllocT<Config>::PointerIndexSize = 0;
+template<typename Config> size_t TaggedAllocT<Config>::StaticPointerIndex[Config::StaticTableSize > 0 ? TaggedAllocCeilPowerOfTwo(Config::StaticTableSize * 2) : 1] = { };
+template<typename Config> size_t* TaggedAllocT<Config>::AddressIndex = nullptr;
+template<typename Config> size_t TaggedAllocT<Config>::AddressIndexCount = 0;
+template<typename Config> size_t TaggedAllocT<Config>::AddressIndexCapacity = 0;
+template<typename Config> size_t TaggedAllocT<Config>::StaticAddressIndex[(Config::AddressIndex && Config::StaticTableSize > 0) ? Config::StaticTableSize : 1] = { };
+template<typename Config> uint32_t TaggedAllocT<Config>::TableOverflowCount = 0;
+template<typename Config> uint32_t TaggedAllocT<Config>::LeakEpoch = 0;
+template<typename Config> size_t TaggedAllocT<Config>::UnbucketedCount = 0;
+template<typename Config> typename TaggedAllocT<Config>::TagLeakInfo TaggedAllocT<Config>::TagLeakTable[Config::LeakEpochs > 0 ? Config::MaxTags : 1] = { };
+template<typename Config> size_t TaggedAllocT<Config>::TotalSize = 0;
+template<typename Config> std::atomic<uint32_t> TaggedAllocT<Config>::ChangeGeneration(0);
+template<typename Config> uint32_t TaggedAllocT<Config>::LayoutGeneration = 0;
+template<typename Config> typename TaggedAllocT<Config>::PublishedView TaggedAllocT<Config>::PublishedViews[Config::PublishedViewSize > 0 ? 2 : 1] = { };
+template<typename Config> std::atomic<uint8_t> TaggedAllocT<Config>::PublishedViewIndex(0);
+template<typename Config> std::atomic<uint32_t> TaggedAllocT<Config>::PublishedViewReaders[2] = { };
+template<typename Config> typename TaggedAllocT<Config>::TraceSlot TaggedAllocT<Config>::TraceRing[Config::TraceSize > 0 ? Config::TraceSize : 1] = { };
+template<typename Config> std::atomic<uint32_t> TaggedAllocT<Config>::TraceHead(0);
+template<typename Config> uint32_t TaggedAllocT<Config>::TraceTail = 0;
+template<typename Config> std::atomic<uint32_t> TaggedAllocT<Config>::TraceDropped(0);
+template<typename Config> typename TaggedAllocT<Config>::TableChange TaggedAllocT<Config>::ChangeLog[Config::ChangeLogSize > 0 ? Config::ChangeLogSize : 1] = { };
+template<typename Config> typename TaggedAllocT<Config>::TagInfo TaggedAllocT<Config>::TagInfoTable[Config::MaxTags] = { };
+template<typename Config> size_t TaggedAllocT<Config>::TagInfoCount = 0;
+template<typename Config> typename TaggedAllocT<Config>::Reclaimer TaggedAllocT<Config>::ReclaimerTable[Config::MaxReclaimers] = { };
+template<typename Config> std::atomic<size_t> TaggedAllocT<Config>::ReclaimerCount(0);
+template<typename Config> typename TaggedAllocT<Config>::MovableSlot TaggedAllocT<Config>::MovableTable[Config::MaxMovable > 0 ? Config::MaxMovable : 1] = { };
+template<typename Config> typename TaggedAllocT<Config>::CompactionStats TaggedAllocT<Config>::LastCompaction = { };
+template<typename Config> bool TaggedAllocT<Config>::Reclaiming = false;
+template<typename Config> typename TaggedAllocT<Config>::FailurePolicy TaggedAllocT<Config>::AllocationFailurePolicy = TaggedAllocT<Config>::FailAssert;
+template<typename Config> typename TaggedAllocT<Config>::FailureHandler TaggedAllocT<Config>::AllocationFailureHandler = nullptr;
+template<typename Config> template<size_t NodeSize, uint32_t PackedTag> void* TaggedAllocT<Config>::NodeCache<NodeSize, PackedTag>::FreeList = nullptr;
+template<typename Config> typename TaggedAllocT<Config>::PoolBase* TaggedAllocT<Config>::PoolList = nullptr;
+template<typename Config> TaggedAllocInstanceInfo TaggedAllocT<Config>::InstanceInfo =
+{
+  nullptr, &TaggedAllocT<Config>::GetAllocationCount, &TaggedAllocT<Config>::GetAllocationTableSize, &TaggedAllocT<Config>::GetTotalSize, &TaggedAllocT<Config>::PrintStats, nullptr
+};
+template<typename Config> typename TaggedAllocT<Config>::ZeroPoolClass TaggedAllocT<Config>::ZeroPool[Config::ZeroPoolClasses > 0 ? Config::ZeroPoolClasses : 1] = { };
+template<typename Config> TaskHandle_t TaggedAllocT<Config>::ZeroPoolTaskHandle = nullptr;
+
+
+/**********************
+ * Registry functions *
+ **********************/
+
+// adds an instance to the registry. this is called by Init().
+inline void TaggedAllocRegistry::Register(TaggedAllocInstanceInfo* info)
+{
+  assert(info);
+  info->Next = Head();
+  Head() = info;
+}
+
+
+// how many instances have been initialised?
+inline size_t TaggedAllocRegistry::GetInstanceCount()
+{
+  size_t count = 0;
+  for (const TaggedAllocInstanceInfo* info = First(); info != nullptr; info = Next(info))
+  {
+    count++;
+  }
+  return count;
+}
+
+
+// how many allocations do we have, across all instances?
+inline size_t TaggedAllocRegistry::GetAllocationCount()
+{
+  size_t count = 0;
+  for (const TaggedAllocInstanceInfo* info = First(); info != nullptr; info = Next(info))
+  {
+    count += info->GetAllocationCount();
+  }
+  return count;
+}
+
+
+// how big are all the tables put together?
+inline size_t TaggedAllocRegistry::GetAllocationTableSize()
+{
+  size_t size = 0;
+  for (const TaggedAllocInstanceInfo* info = First(); info != nullptr; info = Next(info))
+  {
+    size += info->GetAllocationTableSize();
+  }
+  return size;
+}
+
+
+// what's the sum of the size of all the allocations, across all instances?
+inline size_t TaggedAllocRegistry::GetTotalSize()
+{
+  size_t totalSize = 0;
+  for (const TaggedAllocInstanceInfo* info = First(); info != nullptr; info = Next(info))
+  {
+    totalSize += info->GetTotalSize();
+  }
+  return totalSize;
+}
+
+
+// show stats for every instance over serial output (or any other Print), followed by the totals
+inline void TaggedAllocRegistry::PrintStats(Print& out)
+{
+  for (const TaggedAllocInstanceInfo* info = First(); info != nullptr; info = Next(info))
+  {
+    TaggedAllocPrintLine(out, "*** INSTANCE: %s ***\r\n", info->Name);
+    info->PrintStats(out);
+  }
+  TaggedAllocPrintLine(out, "*** ALL INSTANCES ***\r\n");
+  TaggedAllocPrintLine(out, "Instance count: %lu\r\n", (unsigned long)GetInstanceCount());
+  TaggedAllocPrintLine(out, "Allocation count: %lu\r\n", (unsigned long)GetAllocationCount());
+  TaggedAllocPrintLine(out, "Total size: %lu\r\n", (unsigned long)GetTotalSize());
+}
+
+
+/********************
+ * Public functions *
+ ********************/
+
+// allocate a thing
+// the memory is zeroed unless the tag has had zeroing turned off with SetTagZeroing()
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::Allocate(char tag[4])
+{
+  return AllocateInternal<T>(1, tag, AllocFlagsNone);
+}
+
+
+// allocate an array of things
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::AllocateArray(size_t count, char tag[4])
+{
+  return AllocateInternal<T>(count, tag, AllocFlagsNone);
+}
+
+
+// allocate a thing without zeroing it. use this when you're about to overwrite the whole thing anyway.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::AllocateUninitialized(char tag[4])
+{
+  return AllocateInternal<T>(1, tag, AllocNoZero);
+}
+
+
+// allocate an array of things without zeroing it
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::AllocateArrayUninitialized(size_t count, char tag[4])
+{
+  return AllocateInternal<T>(count, tag, AllocNoZero);
+}
+
+
+// sets whether Allocate/AllocateArray zero memory for the given tag. all tags zero by default.
+// this lets you turn zeroing off for a subsystem's buffers without touching any of its call sites.
+template<typename Config>
+void TaggedAllocT<Config>::SetTagZeroing(char tag[4], bool zero)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetConfiguredTagInfo(tag);
+  // the tag table is fixed size, so make it obvious if it's been filled up
+  assert(info);
+  info->ZeroOnAllocate = zero;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// allocate a thing, returning nullptr on failure instead of applying the failure policy.
+// if the policy is FailCallHandler, the handler still gets a chance to free up memory first.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::TryAllocate(char tag[4])
+{
+  return AllocateInternal<T>(1, tag, AllocNoPanic);
+}
+
+
+// allocate an array of things, returning nullptr on failure instead of applying the failure policy.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::TryAllocateArray(size_t count, char tag[4])
+{
+  return AllocateInternal<T>(count, tag, AllocNoPanic);
+}
+
+
+// allocate an array of things without zeroing it, returning nullptr on failure instead of applying the failure policy.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::TryAllocateArrayUninitialized(size_t count, char tag[4])
+{
+  return AllocateInternal<T>(count, tag, AllocNoPanic | AllocNoZero);
+}
+
+
+// start tracking a block that was allocated somewhere else (e.g. with an alignment that the allocation functions don't support).
+// it must be safe to free() the block, since that's what Free() will do with it. returns false if the table is full and couldn't grow.
+template<typename Config>
+bool TaggedAllocT<Config>::Track(void* object, size_t size, char tag[4])
+{
+  assert(object);
+
+  TaggedAllocationDescriptor ta;
+  SetTaggedAllocationDescriptorTime(&ta);
+  ta.Object = object;
+  ta.Size = size;
+  memcpy(ta.Tag, tag, 4);
+
+  // the block already exists, so it counts against the tag's budget without being checked against it.
+  // the tag is charged first (which creates its tag table entry if need be), so that the entry is there when the insert files it in an age bucket.
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  AdjustTagUsage(tag, size, 1);
+  bool inserted = InsertAllocation(ta);
+  if (!inserted)
+  {
+    AdjustTagUsage(tag, -(ptrdiff_t)size, -1);
+  }
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return inserted;
+}
+
+
+// stop tracking a block, without freeing it. returns false if it wasn't tracked.
+template<typename Config>
+bool TaggedAllocT<Config>::Untrack(void* object)
+{
+  return RemoveAllocation(object);
+}
+
+
+// is this pointer the start of a tracked allocation? this is a hash lookup, so it's constant time.
+template<typename Config>
+bool TaggedAllocT<Config>::IsTracked(const void* object)
+{
+  size_t index;
+  return FindAllocation(const_cast<void*>(object), &index);
+}
+
+
+// how big is the tracked allocation that starts at this pointer? returns 0 if it isn't tracked.
+template<typename Config>
+size_t TaggedAllocT<Config>::GetAllocationSize(const void* object)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t index;
+  size_t size = FindAllocation(const_cast<void*>(object), &index) ? AllocationTable[index].Size : 0;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return size;
+}
+
+
+// gets the tag of the tracked allocation that starts at this pointer. returns false if it isn't tracked.
+template<typename Config>
+bool TaggedAllocT<Config>::GetAllocationTag(const void* object, char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t index;
+  bool found = FindAllocation(const_cast<void*>(object), &index);
+  if (found)
+  {
+    memcpy(tag, AllocationTable[index].Tag, 4);
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return found;
+}
+
+
+// finds the tracked allocation that an address falls inside (e.g. a faulting address from a crash dump), and copies its descriptor out.
+// returns false if the address isn't inside any tracked allocation.
+// this is a binary search when the address index is on (TAGGED_ALLOC_ADDRESS_INDEX), and a scan of the table otherwise.
+template<typename Config>
+bool TaggedAllocT<Config>::FindContaining(const void* address, TaggedAllocationDescriptor* allocation)
+{
+  assert(allocation);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uintptr_t addressValue = (uintptr_t)address;
+  TaggedAllocationDescriptor* found = nullptr;
+  if (Config::AddressIndex)
+  {
+    // the candidate is the last allocation that starts at or before the address
+    size_t pos = FindAddressIndexPosition(address);
+    if (pos < AddressIndexCount && (uintptr_t)AllocationTable[AddressIndex[pos]].Object == addressValue)
+    {
+      found = &AllocationTable[AddressIndex[pos]];
+    }
+    else if (pos > 0)
+    {
+      TaggedAllocationDescriptor* candidate = &AllocationTable[AddressIndex[pos - 1]];
+      if (addressValue < (uintptr_t)candidate->Object + candidate->Size)
+      {
+        found = candidate;
+      }
+    }
+  }
+  else
+  {
+    for (size_t n = 0; n < AllocationTableSize && found == nullptr; n++)
+    {
+      TaggedAllocationDescriptor* ta = &AllocationTable[n];
+      if (TAGGED_ALLOC_IS_VALID(*ta) && addressValue >= (uintptr_t)ta->Object && addressValue < (uintptr_t)ta->Object + ta->Size)
+      {
+        found = ta;
+      }
+    }
+  }
+  if (found)
+  {
+    *allocation = *found;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return found != nullptr;
+}
+
+
+// finds every tracked allocation that overlaps the address range [start, end), e.g. a heap region.
+// up to capacity descriptors are copied into allocations (in address order, if the address index is on), and the total number that overlap is returned.
+template<typename Config>
+size_t TaggedAllocT<Config>::FindInRange(const void* start, const void* end, TaggedAllocationDescriptor* allocations, size_t capacity)
+{
+  assert(allocations || capacity == 0);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uintptr_t startValue = (uintptr_t)start;
+  uintptr_t endValue = (uintptr_t)end;
+  size_t count = 0;
+  if (Config::AddressIndex)
+  {
+    // an allocation that starts before the range can still reach into it
+    size_t pos = FindAddressIndexPosition(start);
+    if (pos > 0)
+    {
+      TaggedAllocationDescriptor* ta = &AllocationTable[AddressIndex[pos - 1]];
+      if ((uintptr_t)ta->Object + ta->Size > startValue)
+      {
+        pos--;
+      }
+    }
+    for (; pos < AddressIndexCount && (uintptr_t)AllocationTable[AddressIndex[pos]].Object < endValue; pos++)
+    {
+      if (count < capacity)
+      {
+        allocations[count] = AllocationTable[AddressIndex[pos]];
+      }
+      count++;
+    }
+  }
+  else
+  {
+    for (size_t n = 0; n < AllocationTableSize; n++)
+    {
+      TaggedAllocationDescriptor* ta = &AllocationTable[n];
+      if (TAGGED_ALLOC_IS_VALID(*ta) && (uintptr_t)ta->Object < endValue && (uintptr_t)ta->Object + ta->Size > startValue)
+      {
+        if (count < capacity)
+        {
+          allocations[count] = *ta;
+        }
+        count++;
+      }
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return count;
+}
+
+
+// sets the global allocation failure policy. handler must be set if the policy is FailCallHandler.
+template<typename Config>
+void TaggedAllocT<Config>::SetFailurePolicy(FailurePolicy policy, FailureHandler handler)
+{
+  assert(policy != FailCallHandler || handler != nullptr);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  AllocationFailurePolicy = policy;
+  AllocationFailureHandler = handler;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// how many allocations with this tag have failed?
+template<typename Config>
+uint32_t TaggedAllocT<Config>::GetTagFailureCount(char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  uint32_t failures = info ? info->FailureCount : 0;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return failures;
+}
+
+
+// limits the bytes and/or number of allocations that can be live with a tag at once. pass 0 for either limit to leave it unlimited.
+// the policy decides what happens to an allocation that would go over; timeout is how long BudgetBlock waits before failing.
+// allocations that are already live aren't affected, even if they're over the new budget.
+template<typename Config>
+void TaggedAllocT<Config>::SetTagBudget(char tag[4], size_t maxBytes, size_t maxCount, BudgetPolicy policy, TickType_t timeout)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetConfiguredTagInfo(tag);
+  // the tag table is fixed size, so make it obvious if it's been filled up
+  assert(info);
+  info->MaxBytes = maxBytes;
+  info->MaxCount = maxCount;
+  info->BudgetPolicy = policy;
+  info->BudgetTimeout = timeout;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// gets the current usage and budget for a tag. returns false if nothing has been allocated with the tag, and it has no settings.
+template<typename Config>
+bool TaggedAllocT<Config>::GetTagBudgetStats(char tag[4], TagBudgetStats* stats)
+{
+  assert(stats);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  if (info)
+  {
+    stats->CurrentBytes = info->CurrentBytes;
+    stats->CurrentCount = info->CurrentCount;
+    stats->MaxBytes = info->MaxBytes;
+    stats->MaxCount = info->MaxCount;
+    stats->Policy = static_cast<BudgetPolicy>(info->BudgetPolicy);
+    stats->BreachCount = info->BreachCount;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return info != nullptr;
+}
+
+
+// how many more bytes can be allocated with this tag before it hits its byte budget? this is SIZE_MAX if the tag has no byte budget.
+// it doesn't take the count budget into account, and it doesn't mean the heap actually has that much free.
+template<typename Config>
+size_t TaggedAllocT<Config>::GetTagHeadroom(char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  size_t headroom = SIZE_MAX;
+  if (info && info->MaxBytes > 0)
+  {
+    // LogAndAllow can leave a tag over its budget
+    headroom = (info->CurrentBytes < info->MaxBytes) ? (info->MaxBytes - info->CurrentBytes) : 0;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return headroom;
+}
+
+
+// registers a callback that frees up memory held under a tag. higher priority callbacks run first.
+// every callback runs once when an allocation fails, before the allocation is retried and the failure policy applies.
+// a callback also runs on its own when the total tracked bytes reaches trackedHighWatermark, or free heap drops to freeHeapLowWatermark
+// (0 means no watermark); it runs once per crossing, and is re-armed when things drop back below the watermark.
+// like Init(), register reclaimers from your setup function. returns false if TAGGED_ALLOC_MAX_RECLAIMERS have already been registered.
+template<typename Config>
+bool TaggedAllocT<Config>::RegisterReclaimer(char tag[4], ReclaimCallback callback, int priority, size_t trackedHighWatermark, size_t freeHeapLowWatermark)
+{
+  assert(callback);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  bool result = ReclaimerCount < Config::MaxReclaimers;
+  if (result)
+  {
+    // insertion sort, so that the table is always in the order the callbacks should run
+    size_t index = ReclaimerCount;
+    while (index > 0 && ReclaimerTable[index - 1].Priority < priority)
+    {
+      ReclaimerTable[index] = ReclaimerTable[index - 1];
+      index--;
+    }
+    Reclaimer* reclaimer = &ReclaimerTable[index];
+    *reclaimer = { };
+    memcpy(reclaimer->Tag, tag, 4);
+    reclaimer->Callback = callback;
+    reclaimer->Priority = priority;
+    reclaimer->TrackedHighWatermark = trackedHighWatermark;
+    reclaimer->FreeHeapLowWatermark = freeHeapLowWatermark;
+    ReclaimerCount++;
+    // make sure the tag has an entry, so that the bytes the callback frees can be measured
+    GetConfiguredTagInfo(tag);
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// gets the results for one reclaim callback, in the order they run. returns false if the index is out of range.
+template<typename Config>
+bool TaggedAllocT<Config>::GetReclaimStats(size_t index, ReclaimStats* stats)
+{
+  assert(stats);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  bool result = index < ReclaimerCount;
+  if (result)
+  {
+    Reclaimer* reclaimer = &ReclaimerTable[index];
+    memcpy(stats->Tag, reclaimer->Tag, 4);
+    stats->Priority = reclaimer->Priority;
+    stats->InvocationCount = reclaimer->InvocationCount;
+    stats->ReleasedBytes = reclaimer->ReleasedBytes;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// how many bytes with this tag have reclaim callbacks freed, in total?
+template<typename Config>
+size_t TaggedAllocT<Config>::GetTagReclaimedBytes(char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  size_t reclaimed = info ? info->ReclaimedBytes : 0;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return reclaimed;
+}
+
+
+// sets up the pre-zeroed block pool and starts the idle-priority task that keeps it topped up.
+// zeroed allocations are served from the smallest class that fits, so there's no memset on the caller's critical path.
+// a class only serves requests of more than half its block size, so leave no gaps bigger than that between the classes if you want them covered.
+// the block sizes must be in ascending order. this can only be called once, after Init(): the refill task reads a class's size and then pushes
+// a block of that size without holding the lock in between, so changing the sizes while it's running could put the wrong size of block in a class.
+template<typename Config>
+void TaggedAllocT<Config>::ConfigureZeroPool(const size_t* blockSizes, size_t classCount)
+{
+  static_assert(Config::ZeroPoolClasses > 0, "this instance has no zero pool (see Config::ZeroPoolClasses)");
+  assert(blockSizes);
+  assert(classCount <= Config::ZeroPoolClasses);
+  assert(ZeroPoolTaskHandle == nullptr);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  for (size_t n = 0; n < classCount; n++)
+  {
+    // classes must be ascending so that TakeZeroPoolBlock() picks the tightest fit
+    assert(n == 0 || blockSizes[n] > blockSizes[n - 1]);
+    ZeroPool[n].BlockSize = blockSizes[n];
+    // start out drained, so the initial fill is counted as refill lag too
+    ZeroPool[n].Drained = true;
+    ZeroPool[n].DrainedTime = millis();
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  // name the task after the instance, so that each instance's refill task can be told apart. FreeRTOS copies (and truncates) the name.
+  char taskName[24];
+  snprintf(taskName, sizeof(taskName), "TAZP:%s", Config::Name());
+  BaseType_t created = xTaskCreate(ZeroPoolTask, taskName, Config::ZeroPoolStackSize, nullptr, tskIDLE_PRIORITY, &ZeroPoolTaskHandle);
+  assert(created == pdPASS);
+  xTaskNotifyGive(ZeroPoolTaskHandle);
+}
+
+
+// gets the statistics for one size class of the pool. returns false if the class index is out of range or unused.
+template<typename Config>
+bool TaggedAllocT<Config>::GetZeroPoolStats(size_t classIndex, ZeroPoolStats* stats)
+{
+  assert(stats);
+
+  if (classIndex >= Config::ZeroPoolClasses)
+  {
+    return false;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  ZeroPoolClass* zpc = &ZeroPool[classIndex];
+  stats->BlockSize = zpc->BlockSize;
+  stats->ReadyCount = zpc->ReadyCount;
+  stats->Hits = zpc->Hits;
+  stats->Misses = zpc->Misses;
+  stats->LastRefillLag = zpc->LastRefillLag;
+  stats->MaxRefillLag = zpc->MaxRefillLag;
+  bool used = zpc->BlockSize != 0;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return used;
+}
+
+
+// frees all of the ready blocks in the pool, e.g. if memory is getting tight. the refill task will top it back up after the next pooled allocation.
+template<typename Config>
+void TaggedAllocT<Config>::DrainZeroPool()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  for (size_t n = 0; n < Config::ZeroPoolClasses; n++)
+  {
+    ZeroPoolClass* zpc = &ZeroPool[n];
+    while (zpc->ReadyCount > 0)
+    {
+      TAGGED_ALLOC_FREE(zpc->Ready[--zpc->ReadyCount]);
+    }
+    if (zpc->BlockSize != 0 && !zpc->Drained)
+    {
+      zpc->Drained = true;
+      zpc->DrainedTime = millis();
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// free the thing. it's fine to pass something that isn't tracked (e.g. memory from before Init() was called); it just gets freed.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Free(T* object)
+{
+  // remove the allocation from the table, then free the object
+  if (!RemoveAllocation((void*)object) && Config::TraceSize > 0 && object != nullptr)
+  {
+    TaggedAllocationDescriptor untracked = { };
+    untracked.Object = (void*)object;
+    RecordTrace(TraceFreeUntracked, untracked);
+  }
+  TAGGED_ALLOC_FREE(object);
+}
+
+
+// allocate count separate things, all with the same tag, under a single acquisition of the lock.
+// this is all-or-nothing: if any allocation fails, they're all backed out, and the failure policy applies. returns false on failure.
+template<typename Config>
+template<typename T>
+bool TaggedAllocT<Config>::AllocateBatch(T** objects, size_t count, char tag[4])
+{
+  return AllocateBatchBytes(reinterpret_cast<void**>(objects), nullptr, sizeof(T), count, tag, AllocFlagsNone);
+}
+
+
+// allocate count separate blocks, with sizes taken from the sizes array, all with the same tag.
+template<typename Config>
+bool TaggedAllocT<Config>::AllocateBatch(void** objects, const size_t* sizes, size_t count, char tag[4])
+{
+  assert(sizes);
+  return AllocateBatchBytes(objects, sizes, 0, count, tag, AllocFlagsNone);
+}
+
+
+// free count things under a single acquisition of the lock.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::FreeBatch(T** objects, size_t count)
+{
+  FreeBatch(reinterpret_cast<void**>(objects), count);
+}
+
+
+// free count blocks under a single acquisition of the lock.
+template<typename Config>
+void TaggedAllocT<Config>::FreeBatch(void** objects, size_t count)
+{
+  assert(objects);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  for (size_t b = 0; b < count; b++)
+  {
+    size_t n;
+    if (objects[b] != nullptr && FindAllocation(objects[b], &n))
+    {
+      // clear allocation
+      TaggedAllocationDescriptor removed = AllocationTable[n];
+      RemovePointerIndex(n);
+      RemoveAddressIndex(n);
+      AdjustTagUsage(removed.Tag, -(ptrdiff_t)removed.Size, -1);
+      AllocationTable[n] = { 0 };
+      AllocationCount--;
+      NoteTableChange(ChangeRemoved, removed);
+    }
+    else if (objects[b] != nullptr && Config::TraceSize > 0)
+    {
+      TaggedAllocationDescriptor untracked = { };
+      untracked.Object = objects[b];
+      RecordTrace(TraceFreeUntracked, untracked);
+    }
+  }
+  ShrinkAllocationTableIfSparse();
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  // the actual frees don't need the lock
+  for (size_t b = 0; b < count; b++)
+  {
+    TAGGED_ALLOC_FREE(objects[b]);
+  }
+}
+
+
+// resize an allocation made with AllocateArray() (or friends) to hold newCount elements.
+// this calls realloc(), so the block may be extended in place. if it does move, the existing descriptor is re-keyed to the new pointer.
+// if the realloc() fails then the failure policy applies; if it returns nullptr, the original allocation is still valid.
+// the tag is kept, and the size and time are updated. any new space is zeroed if the tag zeroes by default.
+// as with realloc(), the contents are moved bytewise, so this shouldn't be used for types that aren't trivially copyable.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::Reallocate(T* object, size_t newCount)
+{
+  return static_cast<T*>(ReallocateBytes((void*)object, sizeof(T) * newCount, AllocFlagsNone));
+}
+
+
+// allocate a thing and run its constructor, forwarding any arguments to it.
+// the memory isn't zeroed first, since the constructor is about to initialise it anyway (and T() value-initialises trivial types).
+template<typename Config>
+template<typename T, typename... Args>
+T* TaggedAllocT<Config>::New(char tag[4], Args&&... args)
+{
+  T* object = AllocateInternal<T>(1, tag, AllocNoZero);
+  if (object == nullptr)
+  {
+    return nullptr;
+  }
+  return new (object) T(std::forward<Args>(args)...);
+}
+
+
+// allocate an array of things and default-construct each of them.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::NewArray(size_t count, char tag[4])
+{
+  T* objects = AllocateInternal<T>(count, tag, AllocNoZero);
+  if (objects == nullptr)
+  {
+    return nullptr;
+  }
+  for (size_t n = 0; n < count; n++)
+  {
+    new (&objects[n]) T();
+  }
+  return objects;
+}
+
+
+// run the destructor on a thing that was created with New(), then free it.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Delete(T* object)
+{
+  if (object == nullptr)
+  {
+    return;
+  }
+  object->~T();
+  Free(object);
+}
+
+
+// run the destructors on an array of things that was created with NewArray(), then free it.
+// the element count is recovered from the allocation table, so it doesn't need to be passed in.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::DeleteArray(T* objects)
+{
+  if (objects == nullptr)
+  {
+    return;
+  }
+  if (!std::is_trivially_destructible<T>::value)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    size_t index = 0;
+    bool found = FindAllocation((void*)objects, &index);
+    size_t count = found ? (AllocationTable[index].Size / sizeof(T)) : 0;
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+    // DeleteArray() on something that isn't tracked is a bug in the caller
+    assert(found);
+
+    // destroy in reverse order of construction, like delete[] does
+    while (count > 0)
+    {
+      objects[--count].~T();
+    }
+  }
+  Free(objects);
+}
+
+
+// how many allocations have been refused because the fixed-capacity table was full? this is always 0 when the table is on the heap.
+template<typename Config>
+uint32_t TaggedAllocT<Config>::GetTableOverflowCount()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint32_t overflows = TableOverflowCount;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return overflows;
+}
+
+
+// has Init() been called?
+template<typename Config>
+bool TaggedAllocT<Config>::IsInitialised()
+{
+  return InitOK;
+}
+
+
+// how many allocations do we have?
+template<typename Config>
+size_t TaggedAllocT<Config>::GetAllocationCount()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  size_t count = AllocationCount;
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  return count;
+}
+
+
+// how big is the table?
+template<typename Config>
+size_t TaggedAllocT<Config>::GetAllocationTableSize()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  size_t size = AllocationTableSize;
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  return size;
+}
+
+
+// what's the sum of the size of all the allocations?
+// this is kept up to date as allocations come and go, so it doesn't need to walk the table.
+template<typename Config>
+size_t TaggedAllocT<Config>::GetTotalSize()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  size_t totalSize = TotalSize;
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  
+  return totalSize;
+}
+
+
+// show some stats over serial output, or any other Print (e.g. a file with TaggedAllocFilePrint, or a network client)
+template<typename Config>
+void TaggedAllocT<Config>::PrintStats(Print& out)
+{
+  TaggedAllocPrintLine(out, "*** TAGGED ALLOCATION STATS ***\r\n");
+
+  // printing may take a lot of time, so it isn't practical to hold the lock on the descriptor table while we print stats.
+  // instead, we capture the table a chunk at a time into a buffer on the stack with ForEachAllocation(), and print each chunk with the lock released.
+  // nothing is allocated, so this still works when memory is low (which is usually when you want it most).
+  // if the published view is turned on, we print that instead, and the allocations are only held up while it's brought up to date.
+  RefreshStaleView(0, true);
+  const PublishedView* view = AcquirePublishedView();
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  size_t tableBufferSize = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
+  size_t tableEntryCount = AllocationTableSize;
+  size_t allocCount = view ? view->AllocationCount : AllocationCount;
+  size_t allocSizeTotal = view ? view->TotalSize : GetTotalSize();
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  // print summary
+  if (view)
+  {
+    TaggedAllocPrintLine(out, "Published view: generation %lu (%lu changes behind), age %lums\r\n",
+      (unsigned long)view->Generation, (unsigned long)(GetChangeGeneration() - view->Generation), (unsigned long)(millis() - view->Time));
+  }
+  TaggedAllocPrintLine(out, "Allocation count: %lu\r\n", (unsigned long)allocCount);
+  TaggedAllocPrintLine(out, "Table size: %lu (%lu bytes)\r\n", (unsigned long)tableEntryCount, (unsigned long)tableBufferSize);
+  if (Config::StaticTableSize > 0)
+  {
+    TaggedAllocPrintLine(out, "Table overflows: %lu\r\n", (unsigned long)GetTableOverflowCount());
+  }
+  if (Config::TraceSize > 0)
+  {
+    TaggedAllocPrintLine(out, "Trace: %lu events, %lu dropped\r\n", (unsigned long)TraceHead.load(), (unsigned long)GetTraceDroppedCount());
+  }
+
+  // print tags that have seen allocation failures
+  for (size_t n = 0; n < Config::MaxTags; n++)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    TagInfo info = TagInfoTable[n];
+    TagLeakInfo leak = *GetTagLeakInfo(&TagInfoTable[n]);
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+    uint32_t growthEpochs;
+    if (Config::LeakEpochs > 0 && info.InUse && IsLeakSuspect(leak, &growthEpochs))
+    {
+      TaggedAllocPrintLine(out, "Leak suspect: %.4s, Old: %lu, Grown in %lu of the last %lu epochs\r\n", info.Tag, (unsigned long)leak.OldCount,
+        (unsigned long)growthEpochs, (unsigned long)Config::LeakWindowEpochs);
+    }
+    if (info.InUse && info.FailureCount > 0)
+    {
+      TaggedAllocPrintLine(out, "Failures: %.4s, Count: %lu\r\n", info.Tag, (unsigned long)info.FailureCount);
+    }
+    if (info.InUse && (info.MaxBytes > 0 || info.MaxCount > 0))
+    {
+      TaggedAllocPrintLine(out, "Budget: %.4s, Bytes: %lu/%lu, Count: %lu/%lu, Breaches: %lu\r\n", info.Tag,
+        (unsigned long)info.CurrentBytes, (unsigned long)info.MaxBytes, (unsigned long)info.CurrentCount, (unsigned long)info.MaxCount, (unsigned long)info.BreachCount);
+    }
+  }
+
+  // print pools. the counters are copied out under the lock, one pool at a time, since a pool can be destroyed while we're printing.
+  for (size_t n = 0; ; n++)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    PoolBase* pool = PoolList;
+    for (size_t skip = 0; pool != nullptr && skip < n; skip++)
+    {
+      pool = pool->Next;
+    }
+    char poolTag[4];
+    size_t live = 0, capacity = 0, peak = 0, chunks = 0;
+    if (pool)
+    {
+      memcpy(poolTag, pool->Tag, 4);
+      live = pool->LiveCount;
+      capacity = pool->Capacity;
+      peak = pool->PeakCount;
+      chunks = pool->ChunkCount;
+    }
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+    if (pool == nullptr)
+    {
+      break;
+    }
+    TaggedAllocPrintLine(out, "Pool: %.4s, Live: %lu, Capacity: %lu, Peak: %lu, Chunks: %lu\r\n", poolTag,
+      (unsigned long)live, (unsigned long)capacity, (unsigned long)peak, (unsigned long)chunks);
+  }
+
+  // print the results of the last compaction, if there's been one
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  CompactionStats compaction = LastCompaction;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  if (compaction.LargestFreeBefore > 0)
+  {
+    TaggedAllocPrintLine(out, "Last compaction: moved %lu (%lu bytes), Largest free block: %lu -> %lu\r\n",
+      (unsigned long)compaction.MovedCount, (unsigned long)compaction.MovedBytes, (unsigned long)compaction.LargestFreeBefore, (unsigned long)compaction.LargestFreeAfter);
+  }
+
+  // print reclaim callback results
+  ReclaimStats rs;
+  for (size_t n = 0; GetReclaimStats(n, &rs); n++)
+  {
+    TaggedAllocPrintLine(out, "Reclaimer: %.4s, Priority: %d, Runs: %lu, Released: %lu\r\n", rs.Tag,
+      rs.Priority, (unsigned long)rs.InvocationCount, (unsigned long)rs.ReleasedBytes);
+  }
+
+  // print zero pool stats
+  ZeroPoolStats zps;
+  for (size_t n = 0; n < Config::ZeroPoolClasses; n++)
+  {
+    if (GetZeroPoolStats(n, &zps))
+    {
+      TaggedAllocPrintLine(out, "Zero pool: %lu bytes, Ready: %lu, Hits: %lu, Misses: %lu, Refill lag: %lums (max %lums)\r\n",
+        (unsigned long)zps.BlockSize, (unsigned long)zps.ReadyCount, (unsigned long)zps.Hits, (unsigned long)zps.Misses,
+        (unsigned long)zps.LastRefillLag, (unsigned long)zps.MaxRefillLag);
+    }
+  }
+
+  // print allocations
+  if (view)
+  {
+    for (size_t index = 0; index < view->Count; index++)
+    {
+      PrintAllocation(out, view->Allocations[index]);
+    }
+    if (view->Truncated)
+    {
+      TaggedAllocPrintLine(out, "(published view is full, the rest of the allocations are missing)\r\n");
+    }
+    ReleasePublishedView(view);
+    return;
+  }
+  ForEachAllocation([&out](const TaggedAllocationDescriptor& alloc) {
+    PrintAllocation(out, alloc);
+    return true;
+  });
+}
+
+
+// prints a single allocation's line for PrintStats()
+template<typename Config>
+void TaggedAllocT<Config>::PrintAllocation(Print& out, const TaggedAllocationDescriptor& alloc)
+{
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  // the time is printed in seconds, to two decimal places, without needing floating point formatting
+  TaggedAllocPrintLine(out, "Tag: %.4s, Size: %lu, Time: %lu.%02lu, Pointer: 0x%lX\r\n", alloc.Tag, (unsigned long)alloc.Size,
+    (unsigned long)(alloc.Time / 1000), (unsigned long)((alloc.Time % 1000) / 10), (unsigned long)(uintptr_t)alloc.Object);
+#else
+  TaggedAllocPrintLine(out, "Tag: %.4s, Size: %lu, Pointer: 0x%lX\r\n", alloc.Tag, (unsigned long)alloc.Size, (unsigned long)(uintptr_t)alloc.Object);
+#endif
+}
+
+
+// writes the allocations to out in the binary format described in the output section above, and returns the number of bytes written.
+// the tag dictionary comes from the per-tag totals, so it costs nothing to build. records are encoded one at a time into a buffer on the stack
+// as the table is walked, so the memory used doesn't depend on the size of the table. as with PrintStats(), the published view is used if it's on.
+template<typename Config>
+size_t TaggedAllocT<Config>::WriteBinaryStats(Print& out)
+{
+  // every tag that has allocations right now. anything that turns up later (or didn't fit in the tag table) is written inline instead.
+  char dictionary[Config::MaxTags][4];
+  size_t dictionaryCount = 0;
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  for (size_t n = 0; n < Config::MaxTags; n++)
+  {
+    if (TagInfoTable[n].InUse && TagInfoTable[n].CurrentCount > 0)
+    {
+      memcpy(dictionary[dictionaryCount++], TagInfoTable[n].Tag, 4);
+    }
+  }
+  size_t allocCount = AllocationCount;
+  size_t totalSize = TotalSize;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  RefreshStaleView(0, true);
+  const PublishedView* view = AcquirePublishedView();
+  if (view)
+  {
+    allocCount = view->AllocationCount;
+    totalSize = view->TotalSize;
+  }
+
+  uint8_t buffer[TaggedAllocBinaryRecordMaxSize];
+  size_t length = 0;
+  size_t bytesWritten = 0;
+
+  // header
+  memcpy(buffer, "TAST", 4);
+  length = 4;
+  buffer[length++] = TaggedAllocBinaryStatsVersion;
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  buffer[length++] = 1;
+#else
+  buffer[length++] = 0;
+#endif
+  length += TaggedAllocEncodeVarint(buffer + length, allocCount);
+  length += TaggedAllocEncodeVarint(buffer + length, totalSize);
+  bytesWritten += out.write(buffer, length);
+  length = TaggedAllocEncodeVarint(buffer, millis());
+  bytesWritten += out.write(buffer, length);
+
+  // tag dictionary
+  length = TaggedAllocEncodeVarint(buffer, dictionaryCount);
+  bytesWritten += out.write(buffer, length);
+  if (dictionaryCount > 0)
+  {
+    bytesWritten += out.write(reinterpret_cast<const uint8_t*>(dictionary), dictionaryCount * 4);
+  }
+
+  // records
+  uintptr_t previousObject = 0;
+  uint32_t previousTime = 0;
+  size_t recordCount = 0;
+  auto writeRecord = [&](const TaggedAllocationDescriptor& alloc) {
+    size_t recordLength = 0;
+    size_t tagIndex = 0;
+    while (tagIndex < dictionaryCount && memcmp(dictionary[tagIndex], alloc.Tag, 4) != 0)
+    {
+      tagIndex++;
+    }
+    if (tagIndex < dictionaryCount)
+    {
+      recordLength += TaggedAllocEncodeVarint(buffer, tagIndex + 2);
+    }
+    else
+    {
+      buffer[recordLength++] = 1;
+      memcpy(buffer + recordLength, alloc.Tag, 4);
+      recordLength += 4;
+    }
+    recordLength += TaggedAllocEncodeVarint(buffer + recordLength, alloc.Size);
+    recordLength += TaggedAllocEncodeVarint(buffer + recordLength, TaggedAllocZigZag((int64_t)(intptr_t)((uintptr_t)alloc.Object - previousObject)));
+    previousObject = (uintptr_t)alloc.Object;
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+    recordLength += TaggedAllocEncodeVarint(buffer + recordLength, TaggedAllocZigZag((int64_t)(int32_t)(alloc.Time - previousTime)));
+    previousTime = alloc.Time;
+#endif
+    bytesWritten += out.write(buffer, recordLength);
+    recordCount++;
+    return true;
+  };
+  if (view)
+  {
+    for (size_t index = 0; index < view->Count; index++)
+    {
+      writeRecord(view->Allocations[index]);
+    }
+    ReleasePublishedView(view);
+  }
+  else
+  {
+    ForEachAllocation(writeRecord);
+  }
+  (void)previousTime;
+
+  // end marker
+  buffer[0] = 0;
+  length = 1 + TaggedAllocEncodeVarint(buffer + 1, recordCount);
+  bytesWritten += out.write(buffer, length);
+  return bytesWritten;
+}
+
+
+// copies the valid descriptors in the table into buffer, packed together, without allocating anything. written receives how many were copied.
+// with no cursor, this captures as much as fits from the start of the table, and returns true if that was everything.
+// to capture a big table in pieces, so that the lock is only held for one piece at a time, set a cursor to 0 and keep passing it in until this returns true.
+// the buffer can be on the stack, or statically reserved. note that a capture in pieces isn't an atomic view of the table: allocations that
+// come or go between pieces may or may not show up, and the table can be defragmented in between, which can make some descriptors get missed.
+// NextAllocations() does the same thing, but copes with the table being defragmented.
+template<typename Config>
+bool TaggedAllocT<Config>::Snapshot(TaggedAllocationDescriptor* buffer, size_t capacity, size_t* written, size_t* cursor)
+{
+  assert(buffer || capacity == 0);
+  assert(written);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t position = cursor ? *cursor : 0;
+  size_t count = 0;
+  for (; position < AllocationTableSize && count < capacity; position++)
+  {
+    if (TAGGED_ALLOC_IS_VALID(AllocationTable[position]))
+    {
+      buffer[count++] = AllocationTable[position];
+    }
+  }
+  // skip any empty entries after the last one we copied, so that a capture that's reached the end says so straight away
+  while (position < AllocationTableSize && !TAGGED_ALLOC_IS_VALID(AllocationTable[position]))
+  {
+    position++;
+  }
+  bool complete = position >= AllocationTableSize;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  if (cursor)
+  {
+    *cursor = position;
+  }
+  *written = count;
+  return complete;
+}
+
+
+// copies the next chunk of valid descriptors into buffer, holding the lock only for this chunk. written receives how many were copied.
+// returns true once the walk has reached the end of the table. allocations that come or go between chunks may or may not show up,
+// but if the table is defragmented between chunks, the walk finds its place again rather than skipping or repeating allocations.
+template<typename Config>
+bool TaggedAllocT<Config>::NextAllocations(AllocationCursor* cursor, TaggedAllocationDescriptor* buffer, size_t capacity, size_t* written)
+{
+  assert(cursor);
+  assert(written);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  if (cursor->LayoutGeneration != LayoutGeneration)
+  {
+    // entries have moved since the last chunk. defragmenting keeps them in the same order, so carry on from just after wherever the last
+    // allocation we handed out has ended up. (a walk that hasn't started yet has nothing to lose.)
+    size_t slot = 0;
+    if (cursor->Position > 0)
+    {
+      if (cursor->LastObject != nullptr && FindAllocation(cursor->LastObject, &slot))
+      {
+        cursor->Position = slot + 1;
+      }
+      else
+      {
+        cursor->Incomplete = true;
+      }
+    }
+    cursor->LayoutGeneration = LayoutGeneration;
+  }
+  bool complete = Snapshot(buffer, capacity, written, &cursor->Position);
+  if (*written > 0)
+  {
+    cursor->LastObject = buffer[*written - 1].Object;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return complete;
+}
+
+
+// calls visitor(const TaggedAllocationDescriptor&) for every allocation. the table is copied out a chunk at a time, and the lock is released
+// while the visitor runs, so it's fine for the visitor to take its time, or to allocate and free things.
+// the visitor returns false to stop early, in which case this returns false too.
+template<typename Config>
+template<typename Visitor>
+bool TaggedAllocT<Config>::ForEachAllocation(Visitor visitor)
+{
+  TaggedAllocationDescriptor chunk[TAGGED_ALLOC_ITERATION_CHUNK_SIZE];
+  AllocationCursor cursor = { };
+  bool complete = false;
+  while (!complete)
+  {
+    size_t written = 0;
+    complete = NextAllocations(&cursor, chunk, TAGGED_ALLOC_ITERATION_CHUNK_SIZE, &written);
+    for (size_t index = 0; index < written; index++)
+    {
+      if (!visitor(chunk[index]))
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+
+// gets the change generation, which goes up by one for every allocation added to, removed from, or changed in the table.
+// this doesn't take the lock, so it's fine to call from a reader that's holding a published view.
+template<typename Config>
+uint32_t TaggedAllocT<Config>::GetChangeGeneration()
+{
+  return ChangeGeneration.load();
+}
+
+
+// copies the oldest undrained events from the trace ring into events, oldest first, and returns how many were copied.
+// this doesn't take the lock, and never holds up the tasks writing events. only one task should drain the trace at a time.
+// events that were overwritten before they could be drained are counted by GetTraceDroppedCount(). returns 0 if tracing is turned off.
+template<typename Config>
+size_t TaggedAllocT<Config>::DrainTrace(TraceEvent* events, size_t capacity)
+{
+  if (Config::TraceSize == 0)
+  {
+    return 0;
+  }
+  assert(events || capacity == 0);
+
+  uint32_t head = TraceHead.load();
+  // anything more than a ring's worth behind has already been overwritten
+  if (head - TraceTail > Config::TraceSize)
+  {
+    TraceDropped += head - TraceTail - Config::TraceSize;
+    TraceTail = head - Config::TraceSize;
+  }
+  size_t count = 0;
+  while (TraceTail != head && count < capacity)
+  {
+    TraceSlot* slot = &TraceRing[TraceTail & (Config::TraceSize - 1)];
+    uint32_t sequence = slot->Sequence.load(std::memory_order_acquire);
+    bool lapped = (TraceHead.load() - TraceTail) > Config::TraceSize;
+    if (sequence != TraceTail + 1 && !lapped)
+    {
+      // the writer hasn't finished with it yet, so stop here and pick it up next time
+      break;
+    }
+    if (sequence == TraceTail + 1)
+    {
+      TraceEvent event = slot->Event;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      // if the slot was reused while we were copying it, the copy might be torn
+      if (slot->Sequence.load(std::memory_order_relaxed) == sequence)
+      {
+        events[count++] = event;
+        TraceTail++;
+        continue;
+      }
+    }
+    TraceDropped++;
+    TraceTail++;
+  }
+  return count;
+}
+
+
+// how many trace events were overwritten before DrainTrace() got to them?
+template<typename Config>
+uint32_t TaggedAllocT<Config>::GetTraceDroppedCount()
+{
+  return TraceDropped.load();
+}
+
+
+// gets the changes made to the table after the given generation, oldest first, so that periodic reporting only costs as much as the churn.
+// written receives the number of changes copied to buffer, and nextGeneration receives the generation to pass in next time.
+// to start off, take a full capture (e.g. with ForEachAllocation()) and note GetChangeGeneration() just before it. changes that happen during
+// the capture will then come through again, so apply them by pointer: an add replaces whatever's there, and a remove of something missing is ignored.
+// returns DeltaOverrun if the change log (TAGGED_ALLOC_CHANGE_LOG_SIZE) has wrapped since that generation, or is turned off, in which case
+// nextGeneration is the current generation and a new full capture is needed.
+template<typename Config>
+typename TaggedAllocT<Config>::DeltaResult TaggedAllocT<Config>::SnapshotSince(uint32_t generation, TableChange* buffer, size_t capacity, size_t* written, uint32_t* nextGeneration)
+{
+  assert(buffer || capacity == 0);
+  assert(written);
+  assert(nextGeneration);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint32_t current = ChangeGeneration.load();
+  uint32_t pending = current - generation;
+  DeltaResult result;
+  size_t count = 0;
+  if (Config::ChangeLogSize == 0 || pending > Config::ChangeLogSize)
+  {
+    // this also catches a generation from the future (e.g. from before a reboot), since it wraps round to a huge number of pending changes
+    result = DeltaOverrun;
+    generation = current;
+  }
+  else
+  {
+    result = DeltaOk;
+    while (generation != current && count < capacity)
+    {
+      generation++;
+      const TableChange& change = ChangeLog[generation & (Config::ChangeLogSize - 1)];
+      // every slot is written under the lock along with the generation bump, so this shouldn't happen, but if the slot holds some other
+      // generation then the changes we want are gone, and handing back whatever's there would corrupt the caller's copy
+      if (change.Generation != generation)
+      {
+        result = DeltaOverrun;
+        count = 0;
+        generation = current;
+        break;
+      }
+      buffer[count++] = change;
+    }
+    if (result == DeltaOk && generation != current)
+    {
+      result = DeltaMore;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  *written = count;
+  *nextGeneration = generation;
+  return result;
+}
+
+
+// refreshes the published view from the table. this happens by itself as the table changes (see TAGGED_ALLOC_PUBLISH_CHANGES and
+// TAGGED_ALLOC_PUBLISH_INTERVAL_MS), but you can call it yourself too, e.g. from a low-priority task so that allocations don't pay for the copy.
+// returns false if the published view is turned off, or if a reader is still holding the spare copy (in which case a later change tries again).
+template<typename Config>
+bool TaggedAllocT<Config>::PublishView()
+{
+  if (Config::PublishedViewSize == 0)
+  {
+    return false;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint8_t spare = PublishedViewIndex.load() ^ 1;
+  bool result = (PublishedViewReaders[spare].load() == 0);
+  if (result)
+  {
+    PublishedView* view = &PublishedViews[spare];
+    size_t count = 0;
+    bool truncated = false;
+    for (size_t n = 0; n < AllocationTableSize; n++)
+    {
+      if (TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+      {
+        if (count == Config::PublishedViewSize)
+        {
+          truncated = true;
+          break;
+        }
+        view->Allocations[count++] = AllocationTable[n];
+      }
+    }
+    view->Generation = ChangeGeneration.load();
+    view->Time = millis();
+    view->AllocationCount = AllocationCount;
+    view->TotalSize = TotalSize;
+    view->Count = count;
+    view->Truncated = truncated;
+    // the copy is finished before it's published, so a reader can never see it half-filled
+    PublishedViewIndex.store(spare);
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// refreshes the published view if it's behind the table and at least minAgeMs old. the view is only refreshed as the table changes, so after
+// a burst of changes followed by a quiet spell, it would otherwise stay behind until the next change. if wait is false, this gives up straight
+// away when the lock is busy, rather than wait on an allocation.
+template<typename Config>
+void TaggedAllocT<Config>::RefreshStaleView(uint32_t minAgeMs, bool wait)
+{
+  if (Config::PublishedViewSize == 0 || !InitOK)
+  {
+    return;
+  }
+
+  if (wait)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  }
+  else if (xSemaphoreTakeRecursive(AllocationTableMutex, 0) != pdTRUE)
+  {
+    return;
+  }
+
+  const PublishedView* current = &PublishedViews[PublishedViewIndex.load()];
+  if (current->Generation != ChangeGeneration.load() && (uint32_t)(millis() - current->Time) >= minAgeMs)
+  {
+    PublishView();
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// gets the published view of the table. this never waits for the lock, so it never waits on an allocation. if the view has fallen behind
+// and hasn't been refreshed for TAGGED_ALLOC_PUBLISH_INTERVAL_MS, it's refreshed first, but only if the lock happens to be free.
+// the view doesn't change until it's given back with ReleasePublishedView(). holding onto it stops the spare copy from being refilled
+// once the view has been replaced, so give it back as soon as you can. returns nullptr if the published view is turned off.
+template<typename Config>
+const typename TaggedAllocT<Config>::PublishedView* TaggedAllocT<Config>::AcquirePublishedView()
+{
+  if (Config::PublishedViewSize == 0 || !InitOK)
+  {
+    return nullptr;
+  }
+
+  RefreshStaleView(Config::PublishIntervalMs, false);
+
+  for (;;)
+  {
+    uint8_t index = PublishedViewIndex.load();
+    PublishedViewReaders[index]++;
+    // if the view was replaced before we counted ourselves on it, that copy might be getting refilled, so go round again
+    if (PublishedViewIndex.load() == index)
+    {
+      return &PublishedViews[index];
+    }
+    PublishedViewReaders[index]--;
+  }
+}
+
+
+// gives back a view from AcquirePublishedView()
+template<typename Config>
+void TaggedAllocT<Config>::ReleasePublishedView(const PublishedView* view)
+{
+  if (view == nullptr)
+  {
+    return;
+  }
+  size_t index = view - PublishedViews;
+  assert(index < 2 && PublishedViewReaders[index].load() > 0);
+  PublishedViewReaders[index]--;
+}
+
+
+/*************************
+ * STL allocator adapter *
+ *************************/
+
+template<typename T, uint32_t PackedTag, typename Alloc>
+T* TaggedStdAllocator<T, PackedTag, Alloc>::allocate(size_t count)
+{
+  T* object;
+  if (UseNodeCache && count == 1)
+  {
+    object = static_cast<T*>(Alloc::template NodeCache<NodeSize, PackedTag>::Allocate());
+  }
+  else
+  {
+    char tag[4];
+    TaggedAllocUnpackTag(PackedTag, tag);
+    // the container constructs its elements itself, so there's no point zeroing
+    object = Alloc::template AllocateArrayUninitialized<T>(count, tag);
+  }
+#if __cpp_exceptions
+  if (object == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+#endif
+  return object;
+}
+
+
+template<typename T, uint32_t PackedTag, typename Alloc>
+void TaggedStdAllocator<T, PackedTag, Alloc>::deallocate(T* object, size_t count)
+{
+  if (UseNodeCache && count == 1)
+  {
+    Alloc::template NodeCache<NodeSize, PackedTag>::Free(object);
+  }
+  else
+  {
+    Alloc::Free(object);
+  }
+}
+
+
+// takes a node from the free list, allocating a new chunk of nodes if the list is empty. returns nullptr if the chunk allocation fails.
+// the chunk is allocated without the lock held, so that the budget and failure policies are free to wait. if two tasks both find the list empty,
+// they both add a chunk; the spare nodes just stay on the list.
+template<typename Config>
+template<size_t NodeSize, uint32_t PackedTag>
+void* TaggedAllocT<Config>::NodeCache<NodeSize, PackedTag>::Allocate()
+{
+  for (;;)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    void* node = FreeList;
+    if (node != nullptr)
+    {
+      FreeList = *static_cast<void**>(node);
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    if (node != nullptr)
+    {
+      return node;
+    }
+
+    char tag[4];
+    TaggedAllocUnpackTag(PackedTag, tag);
+    uint8_t* chunk = AllocateInternal<uint8_t>(NodeSize * TAGGED_ALLOC_STD_NODES_PER_CHUNK, tag, AllocNoZero);
+    if (chunk == nullptr)
+    {
+      return nullptr;
+    }
+
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    // thread every node in the chunk onto the free list
+    for (size_t n = 0; n < TAGGED_ALLOC_STD_NODES_PER_CHUNK; n++)
+    {
+      void* chunkNode = chunk + (n * NodeSize);
+      *static_cast<void**>(chunkNode) = FreeList;
+      FreeList = chunkNode;
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+  }
+}
+
+
+// puts a node back on the free list.
+template<typename Config>
+template<size_t NodeSize, uint32_t PackedTag>
+void TaggedAllocT<Config>::NodeCache<NodeSize, PackedTag>::Free(void* node)
+{
+  if (node == nullptr)
+  {
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  *static_cast<void**>(node) = FreeList;
+  FreeList = node;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+/****************
+ * Object pools *
+ ****************/
+
+// the pool doesn't touch the allocator until its first allocation, so pools can be global objects that are constructed before Init().
+template<typename Config>
+TaggedAllocT<Config>::PoolBase::PoolBase(const char tag[4], size_t objectsPerChunk) :
+  ObjectsPerChunk(objectsPerChunk), LiveCount(0), Capacity(0), PeakCount(0), BurstPeak(0), RecentPeak(0), ChunkCount(0), Chunks(nullptr), FreeList(nullptr), Registered(false), Next(nullptr)
+{
+  assert(objectsPerChunk > 0);
+  memcpy(Tag, tag, 4);
+}
+
+
+// takes an object from the free list, allocating a new chunk if the list is empty. returns nullptr if the chunk allocation fails.
+// the chunk is allocated without the lock held, so that the budget and failure policies (and any reclaim callbacks) don't run under it.
+// if two tasks both find the list empty, they both add a chunk, and the spare objects just stay on the list.
+template<typename Config>
+void* TaggedAllocT<Config>::PoolBase::AllocateObject(size_t objectSize, size_t headerSize)
+{
+  for (;;)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    void* object = FreeList;
+    if (object != nullptr)
+    {
+      FreeList = *static_cast<void**>(object);
+      LiveCount++;
+      if (LiveCount > PeakCount)
+      {
+        PeakCount = LiveCount;
+      }
+      if (LiveCount > BurstPeak)
+      {
+        BurstPeak = LiveCount;
+      }
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    if (object != nullptr)
+    {
+      return object;
+    }
+
+    uint8_t* chunk = AllocateInternal<uint8_t>(headerSize + (objectSize * ObjectsPerChunk), Tag, AllocNoZero);
+    if (chunk == nullptr)
+    {
+      return nullptr;
+    }
+
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    ChunkHeader* header = reinterpret_cast<ChunkHeader*>(chunk);
+    header->Next = Chunks;
+    Chunks = header;
+    ChunkCount++;
+    Capacity += ObjectsPerChunk;
+    // thread every object in the chunk onto the free list
+    for (size_t n = 0; n < ObjectsPerChunk; n++)
+    {
+      void* chunkObject = chunk + headerSize + (n * objectSize);
+      *static_cast<void**>(chunkObject) = FreeList;
+      FreeList = chunkObject;
+    }
+    if (!Registered)
+    {
+      Next = PoolList;
+      PoolList = this;
+      Registered = true;
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+  }
+}
+
+
+// puts an object back on the free list. when the last live object comes back, the pool is idle, so chunks beyond its recent peak are given back.
+// the recent peak decays by half each idle cycle, so a pool that keeps bursting to the same size holds on to its chunks, while one whose bursts
+// get smaller shrinks over a few cycles. every object is free at that point, so there's no need to work out which chunks are empty: the first
+// chunks are kept, the free list is rebuilt from just those in O(kept objects), and the rest of the chunks are freed after the lock is released.
+template<typename Config>
+void TaggedAllocT<Config>::PoolBase::FreeObject(void* object, size_t objectSize, size_t headerSize)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  assert(LiveCount > 0);
+  *static_cast<void**>(object) = FreeList;
+  FreeList = object;
+  LiveCount--;
+  ChunkHeader* released = nullptr;
+  if (LiveCount == 0)
+  {
+    RecentPeak = BurstPeak > RecentPeak / 2 ? BurstPeak : RecentPeak / 2;
+    BurstPeak = 0;
+    size_t keepChunks = (RecentPeak + ObjectsPerChunk - 1) / ObjectsPerChunk;
+    if (keepChunks == 0)
+    {
+      keepChunks = 1;
+    }
+    if (ChunkCount > keepChunks)
+    {
+      ChunkHeader* last = Chunks;
+      for (size_t n = 1; n < keepChunks; n++)
+      {
+        last = last->Next;
+      }
+      released = last->Next;
+      last->Next = nullptr;
+      ChunkCount = keepChunks;
+      Capacity = keepChunks * ObjectsPerChunk;
+      FreeList = nullptr;
+      for (ChunkHeader* kept = Chunks; kept != nullptr; kept = kept->Next)
+      {
+        uint8_t* chunk = reinterpret_cast<uint8_t*>(kept);
+        for (size_t n = 0; n < ObjectsPerChunk; n++)
+        {
+          void* chunkObject = chunk + headerSize + (n * objectSize);
+          *static_cast<void**>(chunkObject) = FreeList;
+          FreeList = chunkObject;
+        }
+      }
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  while (released != nullptr)
+  {
+    ChunkHeader* chunk = released;
+    released = chunk->Next;
+    TaggedAllocT::Free(chunk);
+  }
+}
+
+
+// gives back chunks that have no live objects in them, keeping up to keepChunks of them for reuse.
+// this walks the free list and matches each object up with its chunk, so it's O(free objects * chunks). that's fine for an occasional Shrink(),
+// but it's too slow for the free path, which has its own shortcut for when the pool goes idle.
+template<typename Config>
+void TaggedAllocT<Config>::PoolBase::ShrinkChunks(size_t objectSize, size_t headerSize, size_t keepChunks)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t chunkSize = headerSize + (objectSize * ObjectsPerChunk);
+
+  // count the free objects in each chunk
+  for (ChunkHeader* chunk = Chunks; chunk != nullptr; chunk = chunk->Next)
+  {
+    chunk->FreeObjects = 0;
+  }
+  for (void* object = FreeList; object != nullptr; object = *static_cast<void**>(object))
+  {
+    for (ChunkHeader* chunk = Chunks; chunk != nullptr; chunk = chunk->Next)
+    {
+      uint8_t* start = reinterpret_cast<uint8_t*>(chunk);
+      if (static_cast<uint8_t*>(object) >= start && static_cast<uint8_t*>(object) < start + chunkSize)
+      {
+        chunk->FreeObjects++;
+        break;
+      }
+    }
+  }
+
+  // mark the completely free chunks we're going to release, beyond the ones we've been asked to keep
+  size_t released = 0;
+  size_t kept = 0;
+  for (ChunkHeader* chunk = Chunks; chunk != nullptr; chunk = chunk->Next)
+  {
+    if (chunk->FreeObjects == ObjectsPerChunk)
+    {
+      if (kept < keepChunks)
+      {
+        kept++;
+      }
+      else
+      {
+        chunk->FreeObjects = SIZE_MAX;
+        released++;
+      }
+    }
+  }
+
+  if (released > 0)
+  {
+    // take the released chunks' objects off the free list
+    void** link = &FreeList;
+    while (*link != nullptr)
+    {
+      bool inReleasedChunk = false;
+      for (ChunkHeader* chunk = Chunks; chunk != nullptr; chunk = chunk->Next)
+      {
+        uint8_t* start = reinterpret_cast<uint8_t*>(chunk);
+        if (static_cast<uint8_t*>(*link) >= start && static_cast<uint8_t*>(*link) < start + chunkSize)
+        {
+          inReleasedChunk = (chunk->FreeObjects == SIZE_MAX);
+          break;
+        }
+      }
+      if (inReleasedChunk)
+      {
+        *link = *static_cast<void**>(*link);
+      }
+      else
+      {
+        link = static_cast<void**>(*link);
+      }
+    }
+
+    // then unlink and free the chunks themselves
+    ChunkHeader** chunkLink = &Chunks;
+    while (*chunkLink != nullptr)
+    {
+      ChunkHeader* chunk = *chunkLink;
+      if (chunk->FreeObjects == SIZE_MAX)
+      {
+        *chunkLink = chunk->Next;
+        TaggedAllocT::Free(chunk);
+      }
+      else
+      {
+        chunkLink = &chunk->Next;
+      }
+    }
+    ChunkCount -= released;
+    Capacity -= released * ObjectsPerChunk;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// frees every chunk and takes the pool out of the stats. this is called when the pool is destroyed, so there mustn't be any live objects left.
+template<typename Config>
+void TaggedAllocT<Config>::PoolBase::FreeAllChunks()
+{
+  if (!Registered)
+  {
+    // never allocated anything, so there's nothing to do (and Init() might not have been called)
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  assert(LiveCount == 0);
+  while (Chunks != nullptr)
+  {
+    ChunkHeader* chunk = Chunks;
+    Chunks = chunk->Next;
+    TaggedAllocT::Free(chunk);
+  }
+  FreeList = nullptr;
+  ChunkCount = 0;
+  Capacity = 0;
+
+  for (PoolBase** link = &PoolList; *link != nullptr; link = &(*link)->Next)
+  {
+    if (*link == this)
+    {
+      *link = Next;
+      break;
+    }
+  }
+  Registered = false;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// how many objects are currently allocated from the pool?
+template<typename Config>
+size_t TaggedAllocT<Config>::PoolBase::GetLiveCount()
+{
+  if (!Registered)
+  {
+    return 0;
+  }
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  size_t live = LiveCount;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return live;
+}
+
+
+// how many objects can the pool hold without allocating another chunk?
+template<typename Config>
+size_t TaggedAllocT<Config>::PoolBase::GetCapacity()
+{
+  if (!Registered)
+  {
+    return 0;
+  }
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  size_t capacity = Capacity;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return capacity;
+}
+
+
+// what's the most objects that have been live at once?
+template<typename Config>
+size_t TaggedAllocT<Config>::PoolBase::GetPeakCount()
+{
+  if (!Registered)
+  {
+    return 0;
+  }
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  size_t peak = PeakCount;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return peak;
+}
+
+
+template<typename Config>
+template<typename T>
+TaggedAllocT<Config>::Pool<T>::~Pool()
+{
+  this->FreeAllChunks();
+}
+
+
+// takes an uninitialised object from the pool. returns nullptr if the pool needed another chunk and couldn't get one.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::Pool<T>::Allocate()
+{
+  return static_cast<T*>(this->AllocateObject(ObjectSize, HeaderSize));
+}
+
+
+// returns an object to the pool, without running its destructor.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Pool<T>::Free(T* object)
+{
+  if (object == nullptr)
+  {
+    return;
+  }
+  this->FreeObject(object, ObjectSize, HeaderSize);
+}
+
+
+// takes an object from the pool and runs its constructor, forwarding any arguments to it.
+template<typename Config>
+template<typename T>
+template<typename... Args>
+T* TaggedAllocT<Config>::Pool<T>::New(Args&&... args)
+{
+  T* object = Allocate();
+  if (object == nullptr)
+  {
+    return nullptr;
+  }
+  return new (object) T(std::forward<Args>(args)...);
+}
+
+
+// runs the destructor on an object that came from New(), then returns it to the pool.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Pool<T>::Delete(T* object)
+{
+  if (object == nullptr)
+  {
+    return;
+  }
+  object->~T();
+  Free(object);
+}
+
+
+// gives back every chunk that has no live objects in it, e.g. after a burst of activity.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Pool<T>::Shrink()
+{
+  this->ShrinkChunks(ObjectSize, HeaderSize, 0);
+}
+
+
+/***********************
+ * Movable allocations *
+ ***********************/
+
+// allocate count things that the tracker is allowed to move around (with Compact()) whenever they aren't pinned.
+// returns an invalid handle if the allocation fails (rather than applying the failure policy), or if there are already TAGGED_ALLOC_MAX_MOVABLE
+// movable allocations. the failure handler and reclaim callbacks still get their chance first.
+// the memory is zeroed unless the tag has had zeroing turned off. like Reallocate(), moving is bytewise, so T should be trivially copyable.
+// only ever free it with FreeMovable(); passing the pinned pointer to Free() or Reallocate() would leave the handle dangling.
+template<typename Config>
+template<typename T>
+typename TaggedAllocT<Config>::template Handle<T> TaggedAllocT<Config>::AllocateMovable(size_t count, char tag[4])
+{
+  T* object = AllocateInternal<T>(count, tag, AllocNoPanic);
+  uint16_t index;
+  uint16_t generation;
+  if (object == nullptr)
+  {
+    return Handle<T>();
+  }
+  if (!AddMovable(object, &index, &generation))
+  {
+    Free(object);
+    return Handle<T>();
+  }
+  return Handle<T>(index, generation);
+}
+
+
+// gets the current address of a movable allocation, and stops it from being moved until it's unpinned.
+// pins nest, so every Pin() needs a matching Unpin(). don't hang on to the pointer after unpinning.
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::Pin(Handle<T> handle)
+{
+  return static_cast<T*>(PinMovable(handle.Index, handle.Generation));
+}
+
+
+// lets a movable allocation be moved again.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::Unpin(Handle<T> handle)
+{
+  UnpinMovable(handle.Index, handle.Generation);
+}
+
+
+// frees a movable allocation, and invalidates the handle. it mustn't be pinned.
+template<typename Config>
+template<typename T>
+void TaggedAllocT<Config>::FreeMovable(Handle<T>& handle)
+{
+  if (!handle.IsValid())
+  {
+    return;
+  }
+  FreeMovableSlot(handle.Index, handle.Generation);
+  handle = Handle<T>();
+}
+
+
+// moves unpinned movable blocks to lower addresses where the heap has room for them, so that the free space they leave behind can coalesce.
+// highest blocks go first. each one gets a new block from the heap, and is only moved if the new block is lower down; otherwise it stays put.
+// the lock is only held while picking a block and while copying it, not across the whole pass or the malloc() for the new block. the block is
+// checked again once the lock is retaken, and it's only moved if it's still the same allocation and still unpinned; a block that's pinned can't
+// be moved out from under whoever pinned it.
+template<typename Config>
+typename TaggedAllocT<Config>::CompactionStats TaggedAllocT<Config>::Compact()
+{
+  CompactionStats stats = { };
+  stats.LargestFreeBefore = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  bool visited[Config::MaxMovable > 0 ? Config::MaxMovable : 1] = { };
+  for (;;)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    // pick the highest unpinned block we haven't looked at yet
+    MovableSlot* highest = nullptr;
+    size_t highestIndex = 0;
+    for (size_t n = 0; n < Config::MaxMovable; n++)
+    {
+      MovableSlot* slot = &MovableTable[n];
+      if (!visited[n] && slot->Object != nullptr && slot->PinCount == 0 && (highest == nullptr || (uintptr_t)slot->Object > (uintptr_t)highest->Object))
+      {
+        highest = slot;
+        highestIndex = n;
+      }
+    }
+    if (highest == nullptr)
+    {
+      xSemaphoreGiveRecursive(AllocationTableMutex);
+      break;
+    }
+    visited[highestIndex] = true;
+
+    size_t index = 0;
+    bool found = FindAllocation(highest->Object, &index);
+    // movable blocks are always tracked
+    assert(found);
+    void* object = highest->Object;
+    uint16_t generation = highest->Generation;
+    size_t size = AllocationTable[index].Size;
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    void* newObject = TAGGED_ALLOC_MALLOC(size);
+    if (newObject == nullptr)
+    {
+      continue;
+    }
+    if ((uintptr_t)newObject > (uintptr_t)object)
+    {
+      // no better spot for it
+      TAGGED_ALLOC_FREE(newObject);
+      continue;
+    }
+
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    // the block might have been pinned, or freed (and the slot reused), while we didn't have the lock
+    bool movable = highest->Object == object && highest->Generation == generation && highest->PinCount == 0;
+    if (movable)
+    {
+      found = FindAllocation(object, &index);
+      assert(found);
+      TaggedAllocationDescriptor* ta = &AllocationTable[index];
+      memcpy(newObject, object, size);
+      // re-key the descriptor. the time is left alone, since it's still the same allocation.
+      TaggedAllocationDescriptor previous = *ta;
+      RemovePointerIndex(index);
+      RemoveAddressIndex(index);
+      ta->Object = newObject;
+      InsertPointerIndex(index);
+      InsertAddressIndex(index);
+      highest->Object = newObject;
+      NoteTableChange(ChangeRemoved, previous);
+      NoteTableChange(ChangeAdded, *ta);
+      stats.MovedCount++;
+      stats.MovedBytes += size;
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    // whichever block isn't in use any more goes back to the heap
+    TAGGED_ALLOC_FREE(movable ? object : newObject);
+  }
+
+  stats.LargestFreeAfter = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  LastCompaction = stats;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return stats;
+}
+
+
+// puts a newly allocated block into a free slot in the handle table. returns false if the table is full.
+template<typename Config>
+bool TaggedAllocT<Config>::AddMovable(void* object, uint16_t* index, uint16_t* generation)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  bool result = false;
+  for (size_t n = 0; n < Config::MaxMovable; n++)
+  {
+    MovableSlot* slot = &MovableTable[n];
+    if (slot->Object == nullptr)
+    {
+      slot->Object = object;
+      slot->PinCount = 0;
+      // skip 0 when the generation wraps, since that marks an invalid handle
+      slot->Generation++;
+      if (slot->Generation == 0)
+      {
+        slot->Generation = 1;
+      }
+      *index = (uint16_t)n;
+      *generation = slot->Generation;
+      result = true;
+      break;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// looks up a handle's slot in the handle table. the caller must hold the lock. using a stale or invalid handle is a bug in the caller.
+template<typename Config>
+typename TaggedAllocT<Config>::MovableSlot* TaggedAllocT<Config>::GetMovableSlot(uint16_t index, uint16_t generation)
+{
+  assert(generation != 0 && index < Config::MaxMovable);
+  MovableSlot* slot = &MovableTable[index];
+  assert(slot->Object != nullptr && slot->Generation == generation);
+  return slot;
+}
+
+
+template<typename Config>
+void* TaggedAllocT<Config>::PinMovable(uint16_t index, uint16_t generation)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  MovableSlot* slot = GetMovableSlot(index, generation);
+  slot->PinCount++;
+  void* object = slot->Object;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return object;
+}
+
+
+template<typename Config>
+void TaggedAllocT<Config>::UnpinMovable(uint16_t index, uint16_t generation)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  MovableSlot* slot = GetMovableSlot(index, generation);
+  assert(slot->PinCount > 0);
+  slot->PinCount--;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+template<typename Config>
+void TaggedAllocT<Config>::FreeMovableSlot(uint16_t index, uint16_t generation)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  MovableSlot* slot = GetMovableSlot(index, generation);
+  // freeing something that's still pinned would leave the pinner with a dangling pointer
+  assert(slot->PinCount == 0);
+  void* object = slot->Object;
+  slot->Object = nullptr;
+  Free(object);
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+/*********************
+ * Private functions *
+ *********************/
+
+template<typename Config>
+bool TaggedAllocT<Config>::GetFirstEmptySlot(size_t* index)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  bool result = false;
+  for (size_t n = 0; n < AllocationTableSize; n++)
+  {
+    if (!TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+    {
+      *index = n;
+      result = true;
+      break;
+    }
+  }
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+/*bool TaggedAlloc::GetNextValidEntry(size_t start, size_t* index)
+{
+  assert(index);
+  
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  assert(*index < AllocationTableSize);
+  
+  bool result = false;
+  for (size_t n = *index; n < AllocationTableSize; n++)
+  {
+    if (TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+    {
+      *index = n;
+      result = true;
+      break;
+    }
+  }
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}*/
+
+// this checks to see if the allocation table is fragmented, i.e. not all of the allocations are contiguously at the top of the table.
+// start sets where we start looking in the table, which is useful for repeated calls during defragmenting (because we know how many contiguous entries we have)
+// firstEmptyIndex is a pointer to a size_t that receives the first index in the table that is empty (does not contain an allocation), if there is one.
+// firstValidIndex is a pointer to a size_t that receives the first index in the table that contains a valid allocation, if there is one.
+// returns true if the table is fragmented, otherwise false.
+template<typename Config>
+bool TaggedAllocT<Config>::IsAllocationTableFragmented(size_t start, size_t* firstEmptyIndex, size_t* firstValidIndex)
+{
+  assert(firstEmptyIndex);
+  assert(firstValidIndex);
+  
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  assert(start < AllocationTableSize);
+
+  bool reachedInvalidEntry = false;
+  bool fragmented = false;
+  TaggedAllocationDescriptor* entry = AllocationTable + start;
+  for (size_t index = start; index < AllocationTableSize; index++)
+  {
+    bool validEntry = TAGGED_ALLOC_IS_VALID(*entry);
+    if (validEntry && reachedInvalidEntry)
+    {
+      // we reached a valid entry after reaching an invalid entry, so the table is fragmented
+      *firstValidIndex = index;
+      fragmented = true;
+      break;
+    }
+    if (!validEntry)
+    {
+      // reached a invalid entry, mark it and continue.
+      if (!reachedInvalidEntry)
+      {
+        *firstEmptyIndex = index;
+        reachedInvalidEntry = true;
+      }
+    }
+    entry++;
+  }
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return fragmented;
+}
+
+
+// defragments the allocation table, shifting all descriptors to the top of the table.
+template<typename Config>
+void TaggedAllocT<Config>::DefragAllocationTable()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t firstEmptyIndex = 0;
+  size_t firstValidIndex = 0;
+  bool moved = false;
+  // shift allocations down while we detect fragmentation
+  // this is somewhere between O(n log n) and O(n^2), but n is small enough that it should be ok, and we only do this during table shrinkage anyway.
+  while (IsAllocationTableFragmented(firstEmptyIndex, &firstEmptyIndex, &firstValidIndex))
+  {
+    // move the first valid allocation into the first empty slot
+    AllocationTable[firstEmptyIndex] = AllocationTable[firstValidIndex];
+    // the address order doesn't change, so the address index only needs the slot number updating.
+    // this has to happen before the old slot is cleared, since the binary search reads through it.
+    MoveAddressIndex(firstValidIndex, firstEmptyIndex);
+    AllocationTable[firstValidIndex] = { 0 };
+    moved = true;
+  }
+  if (moved)
+  {
+    LayoutGeneration++;
+  }
+  // entries have moved, so the slots in the pointer index are stale
+  RebuildPointerIndex();
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// resizes the allocation table to the given size.
+// returns false if the table couldn't be reallocated, in which case the existing table is left as it was.
+template<typename Config>
+bool TaggedAllocT<Config>::ResizeAllocationTable(size_t newEntryCount)
+{
+  if (Config::StaticTableSize > 0)
+  {
+    // the fixed-capacity table can't be resized. the only caller that gets here is an insert into a full table, so count the overflow.
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    TableOverflowCount++;
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+    return false;
+  }
+
+  assert(newEntryCount >= Config::MinTableSize);
+  
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  /*Serial.print("Resizing allocation table from ");
+  Serial.print(AllocationTableSize);
+  Serial.print(" to ");
+  Serial.print(newEntryCount);
+  Serial.println(" entries.");*/
+  bool result = true;
+  if (newEntryCount != AllocationTableSize)
+  {
+    // the index has to stay at least twice the size of the table. get a new one first, so that failing to get it leaves everything as it was.
+    size_t newIndexSize = TaggedAllocCeilPowerOfTwo(newEntryCount * 2);
+    size_t* newIndex = nullptr;
+    if (newIndexSize != PointerIndexSize)
+    {
+      newIndex = static_cast<size_t*>(TAGGED_ALLOC_CALLOC(newIndexSize, sizeof(size_t)));
+      if (newIndex == nullptr)
+      {
+        xSemaphoreGiveRecursive(AllocationTableMutex);
+        return false;
+      }
+    }
+    // the address index can be grown in place up front, since it's fine for it to be bigger than the table
+    if (Config::AddressIndex && newEntryCount > AddressIndexCapacity)
+    {
+      size_t* newAddressIndex = static_cast<size_t*>(TAGGED_ALLOC_REALLOC(AddressIndex, newEntryCount * sizeof(size_t)));
+      if (newAddressIndex == nullptr)
+      {
+        TAGGED_ALLOC_FREE(newIndex);
+        xSemaphoreGiveRecursive(AllocationTableMutex);
+        return false;
+      }
+      AddressIndex = newAddressIndex;
+      AddressIndexCapacity = newEntryCount;
+    }
+    if (newEntryCount < AllocationTableSize)
+    {
+      // We're shrinking the table. Need to defrag it first!
+      DefragAllocationTable();
+    }
+    size_t newSize = newEntryCount * sizeof(TaggedAllocationDescriptor);
+    TaggedAllocationDescriptor* newTable = static_cast<TaggedAllocationDescriptor*>(TAGGED_ALLOC_REALLOC(AllocationTable, newSize));
+    result = (newTable != nullptr);
+    if (result)
+    {
+      AllocationTable = newTable;
+    }
+    if (newIndex != nullptr)
+    {
+      if (result)
+      {
+        TAGGED_ALLOC_FREE(PointerIndex);
+        PointerIndex = newIndex;
+        PointerIndexSize = newIndexSize;
+      }
+      else
+      {
+        TAGGED_ALLOC_FREE(newIndex);
+      }
+    }
+    // zero the new entries if there are any
+    if (result && newEntryCount > AllocationTableSize)
+    {
+      size_t zeroOffset = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
+      /*Serial.print("Zero offset: ");
+      Serial.println(zeroOffset);*/
+      size_t zeroLength = newSize - zeroOffset;
+      /*Serial.print("Zero length: ");
+      Serial.println(zeroLength);*/
+      memset(AllocationTable + AllocationTableSize, 0, zeroLength);
+    }
+    if (result)
+    {
+      AllocationTableSize = newEntryCount;
+      if (newIndex != nullptr)
+      {
+        RebuildPointerIndex();
+      }
+      // give back the address index's spare space after a shrink. if the heap won't do it, the bigger buffer is still fine.
+      if (Config::AddressIndex && newEntryCount < AddressIndexCapacity)
+      {
+        size_t* newAddressIndex = static_cast<size_t*>(TAGGED_ALLOC_REALLOC(AddressIndex, newEntryCount * sizeof(size_t)));
+        if (newAddressIndex != nullptr)
+        {
+          AddressIndex = newAddressIndex;
+          AddressIndexCapacity = newEntryCount;
+        }
+      }
+    }
+  }
+  
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// inserts a new TaggedAllocationDescriptor object into the allocation table, resizing if necessary.
+// returns false if the table was full and couldn't be expanded, in which case nothing is inserted.
+template<typename Config>
+bool TaggedAllocT<Config>::InsertAllocation(TaggedAllocationDescriptor ta)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  size_t insertIndex = 0;
+  bool result = true;
+  if (!GetFirstEmptySlot(&insertIndex))
+  {
+    // the table is full, need to resize it.
+    if (ResizeAllocationTable(AllocationTableSize + Config::TableExpandStep))
+    {
+      if (!GetFirstEmptySlot(&insertIndex))
+      {
+        // critical failure, we just resized the buffer and it still didn't find an empty slot.
+        assert(false);
+      }
+    }
+    else
+    {
+      result = false;
+    }
+  }
+  if (result)
+  {
+    AllocationTable[insertIndex] = ta;
+    InsertPointerIndex(insertIndex);
+    InsertAddressIndex(insertIndex);
+    AllocationCount++;
+    NoteTableChange(ChangeAdded, ta);
+  }
+    
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// finds an object in the allocation table, via its pointer. index receives its position in the table.
+// returns false if the pointer isn't tracked. this goes through the pointer index, so it doesn't scan the table.
+template<typename Config>
+bool TaggedAllocT<Config>::FindAllocation(void* objectPointer, size_t* index)
+{
   assert(index);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  // linear probing through the pointer index. the index is never full, so there's always an empty entry to stop at.
+  bool result = false;
+  if (objectPointer != nullptr)
+  {
+    for (size_t pos = HashPointer(objectPointer); PointerIndex[pos] != 0; pos = (pos + 1) & (PointerIndexSize - 1))
+    {
+      size_t slot = PointerIndex[pos] - 1;
+      if (AllocationTable[slot].Object == objectPointer)
+      {
+        *index = slot;
+        result = true;
+        break;
+      }
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// adds a table slot to the pointer index. the descriptor must already be in the slot.
+template<typename Config>
+void TaggedAllocT<Config>::InsertPointerIndex(size_t slot)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t pos = HashPointer(AllocationTable[slot].Object);
+  while (PointerIndex[pos] != 0)
+  {
+    pos = (pos + 1) & (PointerIndexSize - 1);
+  }
+  PointerIndex[pos] = slot + 1;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// removes a table slot from the pointer index. this must happen before the descriptor in the slot is cleared or changed.
+// this uses backward-shift deletion rather than tombstones, so the index never fills up with dead entries.
+template<typename Config>
+void TaggedAllocT<Config>::RemovePointerIndex(size_t slot)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t mask = PointerIndexSize - 1;
+  size_t hole = HashPointer(AllocationTable[slot].Object);
+  while (PointerIndex[hole] != slot + 1)
+  {
+    // the slot must be in the index
+    assert(PointerIndex[hole] != 0);
+    hole = (hole + 1) & mask;
+  }
+  // pull later entries in the same run back into the hole, as long as that doesn't move them before their home position
+  for (size_t pos = (hole + 1) & mask; PointerIndex[pos] != 0; pos = (pos + 1) & mask)
+  {
+    size_t home = HashPointer(AllocationTable[PointerIndex[pos] - 1].Object);
+    if (((pos - home) & mask) >= ((pos - hole) & mask))
+    {
+      PointerIndex[hole] = PointerIndex[pos];
+      hole = pos;
+    }
+  }
+  PointerIndex[hole] = 0;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// rebuilds the pointer index from scratch, after the table has been defragmented or the index has been resized.
+template<typename Config>
+void TaggedAllocT<Config>::RebuildPointerIndex()
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  memset(PointerIndex, 0, PointerIndexSize * sizeof(size_t));
+  for (size_t n = 0; n < AllocationTableSize; n++)
+  {
+    if (TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+    {
+      InsertPointerIndex(n);
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// binary search of the address index. returns the position of the first allocation that starts at or after the address.
+template<typename Config>
+size_t TaggedAllocT<Config>::FindAddressIndexPosition(const void* address)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t low = 0;
+  size_t high = AddressIndexCount;
+  while (low < high)
+  {
+    size_t middle = low + (high - low) / 2;
+    if ((uintptr_t)AllocationTable[AddressIndex[middle]].Object < (uintptr_t)address)
+    {
+      low = middle + 1;
+    }
+    else
+    {
+      high = middle;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return low;
+}
+
+
+// adds a table slot to the address index, keeping it sorted. the descriptor must already be in the slot.
+template<typename Config>
+void TaggedAllocT<Config>::InsertAddressIndex(size_t slot)
+{
+  if (!Config::AddressIndex)
+  {
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  assert(AddressIndexCount < AddressIndexCapacity);
+  size_t pos = FindAddressIndexPosition(AllocationTable[slot].Object);
+  memmove(&AddressIndex[pos + 1], &AddressIndex[pos], (AddressIndexCount - pos) * sizeof(size_t));
+  AddressIndex[pos] = slot;
+  AddressIndexCount++;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// removes a table slot from the address index. this must happen before the descriptor in the slot is cleared or changed.
+template<typename Config>
+void TaggedAllocT<Config>::RemoveAddressIndex(size_t slot)
+{
+  if (!Config::AddressIndex)
+  {
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  // step past any other allocations at the same address (e.g. a zero-length block), to the one for this slot
+  size_t pos = FindAddressIndexPosition(AllocationTable[slot].Object);
+  while (AddressIndex[pos] != slot)
+  {
+    pos++;
+    assert(pos < AddressIndexCount);
+  }
+  AddressIndexCount--;
+  memmove(&AddressIndex[pos], &AddressIndex[pos + 1], (AddressIndexCount - pos) * sizeof(size_t));
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// updates the address index after a descriptor has been moved from one table slot to another.
+template<typename Config>
+void TaggedAllocT<Config>::MoveAddressIndex(size_t fromSlot, size_t toSlot)
+{
+  if (!Config::AddressIndex)
+  {
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t pos = FindAddressIndexPosition(AllocationTable[toSlot].Object);
+  while (AddressIndex[pos] != fromSlot)
+  {
+    pos++;
+    assert(pos < AddressIndexCount);
+  }
+  AddressIndex[pos] = toSlot;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// resizes a tracked allocation and updates its descriptor, all under a single hold of the lock.
+// the lock is held across the realloc() so that nobody else can be handed the old address (and insert a duplicate key) before we re-key it.
+// it's only let go if the realloc() fails and the failure policy runs, so callers mustn't be holding it themselves.
+template<typename Config>
+void* TaggedAllocT<Config>::ReallocateBytes(void* objectPointer, size_t newSize, uint8_t flags)
+{
+  assert(objectPointer);
+  assert(newSize > 0);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  size_t index = 0;
+  bool found = FindAllocation(objectPointer, &index);
+  // reallocating something that isn't tracked is a bug in the caller
+  assert(found);
+
+  TaggedAllocationDescriptor* ta = &AllocationTable[index];
+  size_t oldSize = ta->Size;
+  void* newObject = nullptr;
+  for (size_t attempt = 0; newObject == nullptr; attempt++)
+  {
+    // growth counts against the tag's budget. we can't wait for headroom here, since we're holding the lock that anyone freeing memory would need.
+    bool reserved = (newSize <= oldSize) || ReserveTagBudget(ta->Tag, newSize - oldSize, 0, flags | AllocNoBlock);
+    if (reserved)
+    {
+      newObject = TAGGED_ALLOC_REALLOC(ta->Object, newSize);
+      if (newObject == nullptr && newSize > oldSize)
+      {
+        AdjustTagUsage(ta->Tag, -(ptrdiff_t)(newSize - oldSize), 0);
+      }
+    }
+    // same failure policy as allocation. the original block (and its descriptor) is untouched if realloc() fails.
+    // the failure handler and reclaim callbacks run without the lock, as they do for allocations, since they're going to free things and can take
+    // their time. the table might be shuffled around while they run, so the descriptor has to be looked up again afterwards.
+    if (newObject == nullptr)
+    {
+      char tag[4];
+      memcpy(tag, ta->Tag, 4);
+      xSemaphoreGiveRecursive(AllocationTableMutex);
+      if (!HandleAllocationFailure(newSize, tag, flags, attempt))
+      {
+        return nullptr;
+      }
+      assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+      found = FindAllocation(objectPointer, &index);
+      assert(found);
+      ta = &AllocationTable[index];
+    }
+  }
+  if (newSize > oldSize && (flags & AllocNoZero) == 0 && ShouldZeroTag(ta->Tag))
+  {
+    memset(static_cast<uint8_t*>(newObject) + oldSize, 0, newSize - oldSize);
+  }
+  if (newSize < oldSize)
+  {
+    AdjustTagUsage(ta->Tag, -(ptrdiff_t)(oldSize - newSize), 0);
+  }
+  TaggedAllocationDescriptor previous = *ta;
+  RemovePointerIndex(index);
+  RemoveAddressIndex(index);
+  ta->Object = newObject;
+  InsertPointerIndex(index);
+  InsertAddressIndex(index);
+  ta->Size = newSize;
+  SetTaggedAllocationDescriptorTime(ta);
+  NoteTableChange(ChangeRemoved, previous);
+  NoteTableChange(ChangeAdded, *ta);
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return newObject;
+}
+
+
+// called (with the lock held) whenever the contents of the table change. bumps the change generation, adds the change to the change log,
+// and refreshes the published view if it's due.
+template<typename Config>
+void TaggedAllocT<Config>::NoteTableChange(ChangeKind kind, const TaggedAllocationDescriptor& allocation)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint32_t generation = ++ChangeGeneration;
+  if (Config::TraceSize > 0)
+  {
+    RecordTrace(kind == ChangeAdded ? TraceAllocate : TraceFree, allocation);
+  }
+  if (Config::LeakEpochs > 0)
+  {
+    AdjustAgeBuckets(allocation, kind == ChangeAdded ? 1 : -1);
+  }
+  if (Config::ChangeLogSize > 0)
+  {
+    TableChange* change = &ChangeLog[generation & (Config::ChangeLogSize - 1)];
+    change->Generation = generation;
+    change->Kind = kind;
+    change->Allocation = allocation;
+  }
+  if (Config::PublishedViewSize > 0)
+  {
+    const PublishedView* current = &PublishedViews[PublishedViewIndex.load()];
+    if ((generation - current->Generation) >= Config::PublishChanges || (uint32_t)(millis() - current->Time) >= Config::PublishIntervalMs)
+    {
+      PublishView();
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// finds allocations that are at least minAgeMs old, and copies up to capacity of them into allocations. returns how many were copied.
+// no more than perTagLimit are returned for any one tag (0 means no limit), so that one leaky tag doesn't crowd out the others.
+// the age buckets tell us how many old allocations each tag can have, so the table isn't scanned at all when there can't be any,
+// and the scan stops as soon as everything that could match has been found. the scan is done a chunk at a time with ForEachAllocation().
+// returns 0 if time tracking is turned off.
+template<typename Config>
+size_t TaggedAllocT<Config>::FindLongLived(uint32_t minAgeMs, size_t perTagLimit, TaggedAllocationDescriptor* allocations, size_t capacity)
+{
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  assert(allocations || capacity == 0);
+
+  struct TagQuota
+  {
+    char Tag[4];
+    size_t Wanted;
+    size_t Found;
+  };
+  TagQuota quotas[Config::MaxTags];
+  size_t quotaCount = 0;
+  size_t wanted = 0;
+  bool bounded = false;
+  uint32_t now = millis();
+
+  if (Config::LeakEpochs > 0)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    AdvanceLeakEpochs();
+    // count how many allocations each tag could have that are old enough. a bucket counts if anything in its epoch could be old enough.
+    for (size_t n = 0; n < Config::MaxTags; n++)
+    {
+      const TagInfo* info = &TagInfoTable[n];
+      if (!info->InUse || info->CurrentCount == 0)
+      {
+        continue;
+      }
+      const TagLeakInfo* leak = GetTagLeakInfo(info);
+      size_t candidates = leak->OldCount;
+      for (size_t age = 0; age < Config::LeakEpochs; age++)
+      {
+        uint32_t epoch = LeakEpoch - age;
+        if (now - epoch * Config::LeakEpochMs >= minAgeMs)
+        {
+          candidates += leak->AgeBuckets[epoch % Config::LeakEpochs];
+        }
+      }
+      if (candidates > 0)
+      {
+        TagQuota* quota = &quotas[quotaCount++];
+        memcpy(quota->Tag, info->Tag, 4);
+        quota->Wanted = (perTagLimit > 0 && perTagLimit < candidates) ? perTagLimit : candidates;
+        quota->Found = 0;
+        wanted += quota->Wanted;
+      }
+    }
+    // allocations whose tags didn't fit in the tag table aren't in the buckets, so then we don't know when we can stop
+    bounded = (UnbucketedCount == 0);
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    if (bounded && wanted == 0)
+    {
+      return 0;
+    }
+  }
+
+  size_t count = 0;
+  if (capacity == 0)
+  {
+    return 0;
+  }
+  ForEachAllocation([&](const TaggedAllocationDescriptor& alloc) {
+    // ages are worked out with wrap-safe arithmetic, so blocks from before millis() wrapped still count as old. a negative age means the block
+    // was added after we sampled now.
+    uint32_t age = now - alloc.Time;
+    if ((int32_t)age < 0 || age < minAgeMs)
+    {
+      return true;
+    }
+    TagQuota* quota = nullptr;
+    for (size_t n = 0; n < quotaCount && quota == nullptr; n++)
+    {
+      if (memcmp(quotas[n].Tag, alloc.Tag, 4) == 0)
+      {
+        quota = &quotas[n];
+      }
+    }
+    if (quota == nullptr && !bounded && quotaCount < Config::MaxTags)
+    {
+      // without the buckets, quotas are made up as tags turn up
+      quota = &quotas[quotaCount++];
+      memcpy(quota->Tag, alloc.Tag, 4);
+      quota->Wanted = (perTagLimit > 0) ? perTagLimit : SIZE_MAX;
+      quota->Found = 0;
+    }
+    if (quota != nullptr)
+    {
+      if (quota->Found >= quota->Wanted)
+      {
+        return true;
+      }
+      quota->Found++;
+    }
+    allocations[count++] = alloc;
+    return count < capacity && (!bounded || count < wanted);
+  });
+  return count;
+#else
+  return 0;
+#endif
+}
+
+
+// moves the leak watch on, and reports the tags whose count of allocations older than the watch window (TAGGED_ALLOC_LEAK_EPOCHS epochs of
+// TAGGED_ALLOC_LEAK_EPOCH_MS) has gone up in at least TAGGED_ALLOC_LEAK_GROWTH_EPOCHS of the last TAGGED_ALLOC_LEAK_WINDOW_EPOCHS epochs,
+// without going down in any of them. call this from a timer, at least once an epoch.
+// up to capacity suspects are copied into suspects. returns the total number of suspects, which may be more than capacity.
+template<typename Config>
+size_t TaggedAllocT<Config>::LeakWatchTick(LeakSuspect* suspects, size_t capacity)
+{
+  assert(suspects || capacity == 0);
+
+  if (Config::LeakEpochs == 0)
+  {
+    return 0;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  AdvanceLeakEpochs();
+  size_t count = 0;
+  for (size_t n = 0; n < Config::MaxTags; n++)
+  {
+    const TagInfo* info = &TagInfoTable[n];
+    const TagLeakInfo* leak = GetTagLeakInfo(info);
+    uint32_t growthEpochs;
+    if (info->InUse && IsLeakSuspect(*leak, &growthEpochs))
+    {
+      if (count < capacity)
+      {
+        memcpy(suspects[count].Tag, info->Tag, 4);
+        suspects[count].OldCount = leak->OldCount;
+        suspects[count].GrowthEpochs = growthEpochs;
+      }
+      count++;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return count;
+}
+
+
+// adds an event to the trace ring. this doesn't take the lock (whether or not the caller holds it): the position is claimed atomically, and
+// the slot is marked as being written until it's finished, so that DrainTrace() never hands out a half-written event.
+template<typename Config>
+void TaggedAllocT<Config>::RecordTrace(TraceOp op, const TaggedAllocationDescriptor& allocation)
+{
+  uint32_t position = TraceHead.fetch_add(1);
+  TraceSlot* slot = &TraceRing[position & (Config::TraceSize - 1)];
+  slot->Sequence.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  slot->Event.Time = micros();
+  slot->Event.Task = xTaskGetCurrentTaskHandle();
+  slot->Event.Object = allocation.Object;
+  slot->Event.Size = (uint32_t)allocation.Size;
+  memcpy(slot->Event.Tag, allocation.Tag, 4);
+  slot->Event.Op = op;
+  slot->Sequence.store(position + 1, std::memory_order_release);
+}
+
+
+// finds an object in the allocation table, via its pointer, and removes it
+// this is called by Free(). returns false if the pointer isn't tracked.
+template<typename Config>
+bool TaggedAllocT<Config>::RemoveAllocation(void* objectPointer)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  
+  size_t n = 0;
+  TaggedAllocationDescriptor removed = { 0 };
+  bool found = FindAllocation(objectPointer, &n);
+  if (found)
+  {
+    // clear allocation
+    removed = AllocationTable[n];
+    RemovePointerIndex(n);
+    RemoveAddressIndex(n);
+    AdjustTagUsage(removed.Tag, -(ptrdiff_t)removed.Size, -1);
+    AllocationTable[n] = { 0 };
+  }
+  // only count it if we actually found it, otherwise freeing an untracked pointer would throw the count off
+  if (found)
+  {
+    AllocationCount--;
+    NoteTableChange(ChangeRemoved, removed);
+    ShrinkAllocationTableIfSparse();
+  }
   
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return found;
+}
+
+
+// shrinks the table if enough allocations have been removed to justify it.
+template<typename Config>
+void TaggedAllocT<Config>::ShrinkAllocationTableIfSparse()
+{
+  if (Config::StaticTableSize > 0)
+  {
+    // the fixed-capacity table never shrinks (or gets defragmented)
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  // Have we removed enough allocations to justify shrinking the table, as long as we wouldn't be shrinking it too much?
+  // this is a loop because a batch free can remove enough allocations to justify more than one step.
+  while ((AllocationCount > Config::MinTableSize) && 
+         ((AllocationCount + Config::TableShrinkStep) < AllocationTableSize))
+  {
+    size_t shrunkSize = AllocationTableSize - Config::TableShrinkStep;
+    if (!ResizeAllocationTable(shrunkSize))
+    {
+      break;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// makes sure the table has room for at least entryCount descriptors, expanding it in whole steps if it doesn't.
+// returns false if the table needed to grow and couldn't, in which case it's left as it was.
+template<typename Config>
+bool TaggedAllocT<Config>::ReserveTableCapacity(size_t entryCount)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  bool result = true;
+  if (entryCount > AllocationTableSize)
+  {
+    size_t steps = (entryCount - AllocationTableSize + Config::TableExpandStep - 1) / Config::TableExpandStep;
+    result = ResizeAllocationTable(AllocationTableSize + (steps * Config::TableExpandStep));
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// finds the settings entry for a tag. if create is true, an entry with default settings is added when the tag isn't present.
+// returns nullptr if the tag isn't present (or there's no room, when creating). only configured tags can use the last quarter of the table.
+template<typename Config>
+typename TaggedAllocT<Config>::TagInfo* TaggedAllocT<Config>::GetTagInfo(const char tag[4], bool create, bool configured)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint32_t hash;
+  memcpy(&hash, tag, sizeof(hash));
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3b;
+  hash ^= hash >> 16;
+
+  // linear probing. entries are never removed, so the first unused entry marks the end of the probe sequence.
+  TagInfo* result = nullptr;
+  for (size_t probe = 0; probe < Config::MaxTags; probe++)
+  {
+    TagInfo* info = &TagInfoTable[(hash + probe) & (Config::MaxTags - 1)];
+    if (!info->InUse)
+    {
+      if (create && (configured || TagInfoCount < AutoTagLimit) && TagInfoCount < Config::MaxTags)
+      {
+        TagInfoCount++;
+        memcpy(info->Tag, tag, 4);
+        info->InUse = true;
+        info->ZeroOnAllocate = true;
+        result = info;
+      }
+      break;
+    }
+    if (memcmp(info->Tag, tag, 4) == 0)
+    {
+      result = info;
+      break;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return result;
+}
+
+
+// gets the entry for a tag that's being given settings, creating it if need be. unlike the entries that allocations create, these can use
+// the whole table. if the tag was turned away from a full table earlier, its live allocations are found with a scan of the allocation table
+// so that its totals start out right. (an allocation of the tag that's in flight while this happens can be missed, so if the table might
+// have filled up, give tags their settings before allocating with them.)
+template<typename Config>
+typename TaggedAllocT<Config>::TagInfo* TaggedAllocT<Config>::GetConfiguredTagInfo(const char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  if (info == nullptr)
+  {
+    // if there's still room below the automatic limit then the tag can't have been turned away, so it has nothing live to count
+    bool scan = TagInfoCount >= AutoTagLimit;
+    info = GetTagInfo(tag, true, true);
+    if (info && scan)
+    {
+      for (size_t index = 0; index < AllocationTableSize; index++)
+      {
+        const TaggedAllocationDescriptor& allocation = AllocationTable[index];
+        if (TAGGED_ALLOC_IS_VALID(allocation) && memcmp(allocation.Tag, tag, 4) == 0)
+        {
+          info->CurrentBytes += allocation.Size;
+          info->CurrentCount++;
+          if (Config::LeakEpochs > 0)
+          {
+            UnbucketedCount--;
+            AdjustAgeBuckets(allocation, 1);
+          }
+        }
+      }
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return info;
+}
+
+
+// should allocations with this tag be zeroed by default?
+template<typename Config>
+bool TaggedAllocT<Config>::ShouldZeroTag(const char tag[4])
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TagInfo* info = GetTagInfo(tag, false);
+  bool zero = (info == nullptr) || info->ZeroOnAllocate;
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return zero;
+}
+
+
+// updates the running totals for a tag (and the overall total) as allocations are added, removed or resized.
+// if there's no room for the tag in the tag table, the tag's own totals just aren't kept. that's consistent, since entries are never removed from
+// the tag table, and GetConfiguredTagInfo() catches a tag's totals up if it's given an entry later.
+template<typename Config>
+void TaggedAllocT<Config>::AdjustTagUsage(const char tag[4], ptrdiff_t bytes, ptrdiff_t count)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  TotalSize += bytes;
+  TagInfo* info = GetTagInfo(tag, true);
+  if (info)
+  {
+    info->CurrentBytes += bytes;
+    info->CurrentCount += count;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// moves the leak watch on to the current epoch. for every epoch that's passed, the oldest bucket of each tag is added to its old count.
+// then the old count is compared with where it was last time, and the result is shifted into the tag's growth and drop histories.
+// that happens once per call however many epochs have passed, so catching up after a quiet spell counts as one epoch of growth, not several;
+// the epochs that were skipped are recorded as flat. this is O(MaxTags) per call, and it's called lazily whenever an allocation is added or
+// removed (and by LeakWatchTick()), so nothing ever needs to scan the table.
+template<typename Config>
+void TaggedAllocT<Config>::AdvanceLeakEpochs()
+{
+  if (Config::LeakEpochs == 0)
+  {
+    return;
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  uint32_t epoch = millis() / Config::LeakEpochMs;
+  uint32_t elapsed = epoch - LeakEpoch;
+  if (elapsed > 0)
+  {
+    // after a long quiet spell, every bucket has aged out, and stepping through one more lap of them than there are buckets empties them all
+    uint32_t steps = (elapsed > Config::LeakEpochs + 1) ? (Config::LeakEpochs + 1) : elapsed;
+    uint32_t windowMask = (Config::LeakWindowEpochs >= 32) ? 0xFFFFFFFF : ((1u << Config::LeakWindowEpochs) - 1);
+    for (size_t n = 0; n < Config::MaxTags; n++)
+    {
+      if (!TagInfoTable[n].InUse)
+      {
+        continue;
+      }
+      TagLeakInfo* leak = &TagLeakTable[n];
+      for (uint32_t step = 1; step <= steps; step++)
+      {
+        // the bucket for each new epoch is the one that held the epoch that's just become too old to have its own bucket
+        size_t bucket = (epoch - steps + step) % Config::LeakEpochs;
+        leak->OldCount += leak->AgeBuckets[bucket];
+        leak->AgeBuckets[bucket] = 0;
+      }
+      leak->GrowthHistory = (elapsed >= 32) ? 0 : (leak->GrowthHistory << elapsed);
+      leak->DropHistory = (elapsed >= 32) ? 0 : (leak->DropHistory << elapsed);
+      if (leak->OldCount > leak->LastOldCount)
+      {
+        leak->GrowthHistory |= 1;
+      }
+      else if (leak->OldCount < leak->LastOldCount)
+      {
+        leak->DropHistory |= 1;
+      }
+      leak->GrowthHistory &= windowMask;
+      leak->DropHistory &= windowMask;
+      leak->LastOldCount = leak->OldCount;
+    }
+    LeakEpoch = epoch;
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// is the tag a leak suspect? a leak doesn't have to leak every epoch, so flat epochs don't count against it, but any drop in the window does.
+// a one-off rise (like allocations made at startup that live forever) drops out of the window and stops counting. growthEpochs receives the
+// number of epochs in the window that the old count went up in.
+template<typename Config>
+bool TaggedAllocT<Config>::IsLeakSuspect(const TagLeakInfo& leak, uint32_t* growthEpochs)
+{
+  *growthEpochs = (uint32_t)__builtin_popcount(leak.GrowthHistory);
+  return *growthEpochs >= Config::LeakGrowthEpochs && leak.DropHistory == 0;
+}
+
+
+// counts an allocation into (or, with a negative count, out of) its tag's age bucket, based on when it was made.
+template<typename Config>
+void TaggedAllocT<Config>::AdjustAgeBuckets(const TaggedAllocationDescriptor& allocation, ptrdiff_t count)
+{
+#ifndef TAGGED_ALLOC_NO_TIME_TRACKING
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+  AdvanceLeakEpochs();
+  // the entry (if the tag has one) was made when the allocation was charged to the tag, so there's no need to create one here
+  TagInfo* info = GetTagInfo(allocation.Tag, false);
+  if (info == nullptr)
+  {
+    UnbucketedCount += count;
+  }
+  else
+  {
+    // a descriptor keeps its time when it's moved, so it goes back into the same bucket it came out of
+    TagLeakInfo* leak = GetTagLeakInfo(info);
+    uint32_t epoch = allocation.Time / Config::LeakEpochMs;
+    if (LeakEpoch - epoch < Config::LeakEpochs)
+    {
+      leak->AgeBuckets[epoch % Config::LeakEpochs] += count;
+    }
+    else
+    {
+      leak->OldCount += count;
+    }
+  }
+
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+#endif
+}
+
+
+// checks size bytes (in count allocations) against the tag's budget and, if they're allowed, counts them against the tag straight away.
+// the check and the reservation happen under one hold of the lock, so two tasks can't both squeeze into the last of the headroom.
+// returns false if the budget refused it. if the allocation then fails, the caller has to hand the reservation back with AdjustTagUsage().
+template<typename Config>
+bool TaggedAllocT<Config>::ReserveTagBudget(char tag[4], size_t size, size_t count, uint8_t flags)
+{
+  TickType_t startTicks = xTaskGetTickCount();
+  for (;;)
+  {
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+
+    TagInfo* info = GetTagInfo(tag, false);
+    bool overBudget = info &&
+      ((info->MaxBytes > 0 && info->CurrentBytes + size > info->MaxBytes) ||
+       (info->MaxCount > 0 && info->CurrentCount + count > info->MaxCount));
+    BudgetPolicy policy = info ? static_cast<BudgetPolicy>(info->BudgetPolicy) : BudgetFail;
+    bool waiting = overBudget && policy == BudgetBlock && (flags & AllocNoBlock) == 0 &&
+      (TickType_t)(xTaskGetTickCount() - startTicks) < info->BudgetTimeout;
+    uint32_t breaches = 0;
+    if (overBudget && !waiting)
+    {
+      breaches = ++info->BreachCount;
+    }
+    bool allowed = !overBudget || policy == BudgetLogAndAllow;
+    if (allowed)
+    {
+      AdjustTagUsage(tag, size, count);
+    }
+
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    if (!waiting)
+    {
+      // a tag that's stuck over budget breaches on every allocation, and this can be called from malloc, so only warn on the 1st, 2nd, 4th,
+      // 8th... breach. BreachCount (and PrintStats()) still has the full count.
+      if (overBudget && allowed && (breaches & (breaches - 1)) == 0)
+      {
+        TaggedAllocPrintLine(Serial, "TaggedAlloc: over budget: %.4s, Size: %lu, Breaches: %lu\r\n", tag, (unsigned long)size, (unsigned long)breaches);
+      }
+      return allowed;
+    }
+    // there's no event for "something with this tag was freed", so just poll. we let go of the lock before sleeping, but that only helps if the
+    // caller isn't holding it too: anything that calls this with the lock held has to pass AllocNoBlock, or everyone else stalls behind the sleep.
+    vTaskDelay(1);
+  }
+}
+
+
+// generic allocation function that actually builds the allocation descriptor
+template<typename Config>
+void* TaggedAllocT<Config>::AllocateBytes(size_t count, size_t elementSize, char tag[4], uint8_t flags)
+{
+  // create a descriptor
+  TaggedAllocationDescriptor ta;
+  // set the time (this is inlined, and does nothing if the TAGGED_ALLOC_NO_TIME_TRACKING preprocessor flag is set
+  SetTaggedAllocationDescriptorTime(&ta);
+  size_t size = elementSize * count;
+  // copy tag
+  ta.Tag[0] = tag[0];
+  ta.Tag[1] = tag[1];
+  ta.Tag[2] = tag[2];
+  ta.Tag[3] = tag[3];
+  // zeroed allocations go through calloc() rather than malloc()+memset(), so that the heap can skip zeroing memory it knows is already clean.
+  bool zero = ((flags & AllocNoZero) == 0) && ShouldZeroTag(tag);
+  for (size_t attempt = 0; ; attempt++)
+  {
+    ta.Size = size;
+    // check the tag's budget first. going over it is treated just like the heap running out.
+    if (ReserveTagBudget(tag, ta.Size, 1, flags))
+    {
+      // allocate object. a block from the zero pool can be bigger than we asked for, and the descriptor (and the tag) gets charged for all of it,
+      // so that the totals match what's really held. that can take the tag past its byte budget by the rounding up to the pool's class size.
+      size_t blockSize = 0;
+      ta.Object = AllocateBlock(count, elementSize, zero, &blockSize);
+      // insert the descriptor into the allocation table. if the table can't grow to fit it, back the allocation out again.
+      if (ta.Object != nullptr)
+      {
+        if (blockSize > ta.Size)
+        {
+          AdjustTagUsage(tag, blockSize - ta.Size, 0);
+          ta.Size = blockSize;
+        }
+        if (InsertAllocation(ta))
+        {
+          CheckMemoryPressure();
+          // done :)
+          return ta.Object;
+        }
+        TAGGED_ALLOC_FREE(ta.Object);
+      }
+      AdjustTagUsage(tag, -(ptrdiff_t)ta.Size, -1);
+    }
+    if (!HandleAllocationFailure(size, tag, flags, attempt))
+    {
+      return nullptr;
+    }
+  }
+}
+
+
+// allocates a batch of blocks and inserts all of their descriptors with a single acquisition of the lock.
+// if sizes is nullptr then every block is uniformSize bytes.
+template<typename Config>
+bool TaggedAllocT<Config>::AllocateBatchBytes(void** objects, const size_t* sizes, size_t uniformSize, size_t count, char tag[4], uint8_t flags)
+{
+  assert(objects);
+
+  bool zero = ((flags & AllocNoZero) == 0) && ShouldZeroTag(tag);
+  size_t totalSize = 0;
+  for (size_t b = 0; b < count; b++)
+  {
+    totalSize += sizes ? sizes[b] : uniformSize;
+  }
+
+  for (size_t attempt = 0; ; attempt++)
+  {
+    // the whole batch is checked against the tag's budget up front
+    if (!ReserveTagBudget(tag, totalSize, count, flags))
+    {
+      if (!HandleAllocationFailure(totalSize, tag, flags, attempt))
+      {
+        return false;
+      }
+      continue;
+    }
+
+    // allocate all of the blocks first, without the lock held.
+    // batches don't use the zero pool, since its blocks can be bigger than asked for, and we'd have nowhere to keep each one's real size until it's inserted.
+    size_t allocated = 0;
+    for (; allocated < count; allocated++)
+    {
+      size_t size = sizes ? sizes[allocated] : uniformSize;
+      objects[allocated] = AllocateBlock(1, size, zero, nullptr);
+      if (objects[allocated] == nullptr)
+      {
+        break;
+      }
+    }
+
+    if (allocated == count)
+    {
+      assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+      // grow the table once for the whole batch, then fill empty slots in a single pass
+      bool reserved = ReserveTableCapacity(AllocationCount + count);
+      if (reserved)
+      {
+        size_t slot = 0;
+        for (size_t b = 0; b < count; b++)
+        {
+          while (TAGGED_ALLOC_IS_VALID(AllocationTable[slot]))
+          {
+            slot++;
+          }
+          TaggedAllocationDescriptor* ta = &AllocationTable[slot];
+          SetTaggedAllocationDescriptorTime(ta);
+          ta->Size = sizes ? sizes[b] : uniformSize;
+          memcpy(ta->Tag, tag, 4);
+          ta->Object = objects[b];
+          InsertPointerIndex(slot);
+          InsertAddressIndex(slot);
+          AllocationCount++;
+          NoteTableChange(ChangeAdded, *ta);
+        }
+      }
+      xSemaphoreGiveRecursive(AllocationTableMutex);
+
+      if (reserved)
+      {
+        CheckMemoryPressure();
+        return true;
+      }
+    }
+
+    // back out everything we managed to allocate, so that the failure doesn't leave anything behind
+    for (size_t b = 0; b < allocated; b++)
+    {
+      TAGGED_ALLOC_FREE(objects[b]);
+      objects[b] = nullptr;
+    }
+    AdjustTagUsage(tag, -(ptrdiff_t)totalSize, -(ptrdiff_t)count);
+    if (!HandleAllocationFailure(totalSize, tag, flags, attempt))
+    {
+      return false;
+    }
+  }
+}
+
+
+// gets a block of memory from the heap (or the zero pool), without tracking it.
+// blockSize receives the real size of the block, which is bigger than asked for if it came from the zero pool. pass nullptr to keep out of the pool.
+template<typename Config>
+void* TaggedAllocT<Config>::AllocateBlock(size_t count, size_t elementSize, bool zero, size_t* blockSize)
+{
+  void* block = nullptr;
+  size_t size = count * elementSize;
+  // if we need zeroed memory, try to grab a block that the refill task has already zeroed
+  if (Config::ZeroPoolClasses > 0 && zero && blockSize != nullptr)
+  {
+    block = TakeZeroPoolBlock(&size);
+  }
+  if (block == nullptr)
+  {
+    block = zero ? TAGGED_ALLOC_CALLOC(count, elementSize) : TAGGED_ALLOC_MALLOC(size);
+  }
+  if (blockSize != nullptr)
+  {
+    *blockSize = size;
+  }
+  return block;
+}
+
+
+// applies the failure policy after an allocation fails. returns true if the allocation should be retried.
+template<typename Config>
+bool TaggedAllocT<Config>::HandleAllocationFailure(size_t size, char tag[4], uint8_t flags, size_t attempt)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  FailurePolicy policy = AllocationFailurePolicy;
+  FailureHandler handler = AllocationFailureHandler;
+  bool hasReclaimers = ReclaimerCount > 0;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  // the first failure runs the reclaim callbacks and retries, before the failure policy gets a look in
+  if (hasReclaimers)
+  {
+    if (attempt == 0 && RunReclaimers(size))
+    {
+      return true;
+    }
+    attempt = (attempt > 0) ? attempt - 1 : 0;
+  }
+
+  // we don't take the lock around the handler ourselves, since it's probably going to free some things
+  if (policy == FailCallHandler && attempt < Config::FailureRetries && handler(size, tag))
+  {
+    return true;
+  }
+
+  // we're giving up on this allocation, so count it against the tag
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  TagInfo* info = GetTagInfo(tag, true);
+  if (info)
+  {
+    info->FailureCount++;
+  }
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  if (Config::TraceSize > 0)
+  {
+    TaggedAllocationDescriptor failed = { };
+    failed.Size = size;
+    memcpy(failed.Tag, tag, 4);
+    RecordTrace(TraceAllocateFailed, failed);
+  }
 
-  assert(*index < AllocationTableSize);
-  
-  bool result = false;
-  for (size_t n = *index; n < AllocationTableSize; n++)
+  // throw an assertion fail, unless the policy or the caller says not to
+  if (policy == FailAssert && (flags & AllocNoPanic) == 0)
   {
-    if (TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+    assert(false);
+  }
+  return false;
+}
+
+
+// runs a single reclaim callback, and records how far its tag's tracked bytes dropped.
+// the lock isn't held around the callback, since it's going to free things.
+template<typename Config>
+void TaggedAllocT<Config>::InvokeReclaimer(size_t index, size_t bytesNeeded)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  Reclaimer* reclaimer = &ReclaimerTable[index];
+  TagInfo* info = GetTagInfo(reclaimer->Tag, false);
+  size_t bytesBefore = info ? info->CurrentBytes : 0;
+  ReclaimCallback callback = reclaimer->Callback;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  callback(bytesNeeded);
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  // the callback may have freed the tag's first allocation, which creates its entry
+  info = GetTagInfo(reclaimer->Tag, false);
+  size_t bytesAfter = info ? info->CurrentBytes : 0;
+  size_t released = (bytesAfter < bytesBefore) ? (bytesBefore - bytesAfter) : 0;
+  reclaimer->InvocationCount++;
+  reclaimer->ReleasedBytes += released;
+  if (info)
+  {
+    info->ReclaimedBytes += released;
+  }
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+}
+
+
+// runs every reclaim callback, in priority order. this is called when an allocation fails.
+// returns false if there was nothing to run, or if a callback is already running (i.e. the callback's own allocation failed).
+template<typename Config>
+bool TaggedAllocT<Config>::RunReclaimers(size_t bytesNeeded)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  bool run = ReclaimerCount > 0 && !Reclaiming;
+  Reclaiming = Reclaiming || run;
+  size_t count = ReclaimerCount;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+  if (!run)
+  {
+    return false;
+  }
+  for (size_t n = 0; n < count; n++)
+  {
+    InvokeReclaimer(n, bytesNeeded);
+  }
+
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+  Reclaiming = false;
+  xSemaphoreGiveRecursive(AllocationTableMutex);
+  return true;
+}
+
+
+// runs any reclaim callbacks whose watermark has just been crossed. this is called after each successful allocation.
+template<typename Config>
+void TaggedAllocT<Config>::CheckMemoryPressure()
+{
+  // reclaimers are registered up front, so this is a cheap way out for the common case of there being none
+  if (ReclaimerCount == 0)
+  {
+    return;
+  }
+
+  size_t freeHeap = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  for (size_t n = 0; ; n++)
+  {
+    // the crossing is detected and flagged under the lock, so only one task runs the callback for it
+    assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+    if (n >= ReclaimerCount)
     {
-      *index = n;
-      result = true;
+      xSemaphoreGiveRecursive(AllocationTableMutex);
       break;
     }
+    Reclaimer* reclaimer = &ReclaimerTable[n];
+    size_t overTracked = (reclaimer->TrackedHighWatermark > 0 && TotalSize >= reclaimer->TrackedHighWatermark) ? (TotalSize - reclaimer->TrackedHighWatermark) : 0;
+    size_t underHeap = (reclaimer->FreeHeapLowWatermark > 0 && freeHeap <= reclaimer->FreeHeapLowWatermark) ? (reclaimer->FreeHeapLowWatermark - freeHeap) : 0;
+    bool pressure = (reclaimer->TrackedHighWatermark > 0 && TotalSize >= reclaimer->TrackedHighWatermark) ||
+                    (reclaimer->FreeHeapLowWatermark > 0 && freeHeap <= reclaimer->FreeHeapLowWatermark);
+    bool crossed = pressure && !reclaimer->UnderPressure && !Reclaiming;
+    // a crossing that comes while another callback is running isn't flagged, so that a later check still sees it as a crossing and runs the callback
+    if (crossed || !pressure)
+    {
+      reclaimer->UnderPressure = pressure;
+    }
+    xSemaphoreGiveRecursive(AllocationTableMutex);
+
+    if (crossed)
+    {
+      InvokeReclaimer(n, overTracked > underHeap ? overTracked : underHeap);
+    }
   }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
-  return result;
-}*/
+}
 
-// this checks to see if the allocation table is fragmented, i.e. not all of the allocations are contiguously at the top of the table.
-// start sets where we start looking in the table, which is useful for repeated calls during defragmenting (because we know how many contiguous entries we have)
-// firstEmptyIndex is a pointer to a size_t that receives the first index in the table that is empty (does not contain an allocation), if there is one.
-// firstValidIndex is a pointer to a size_t that receives the first index in the table that contains a valid allocation, if there is one.
-// returns true if the table is fragmented, otherwise false.
-bool TaggedAlloc::IsAllocationTableFragmented(size_t start, size_t* firstEmptyIndex, size_t* firstValidIndex)
-{
-  assert(firstEmptyIndex);
-  assert(firstValidIndex);
-  
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
 
-  assert(start < AllocationTableSize);
+// takes a pre-zeroed block from the smallest pool class that will fit the requested size, and sets size to the size of the block.
+// the allocation is charged for the whole block, so a class only serves requests bigger than half its block size; anything smaller would
+// waste more than it uses (and a run of tiny allocations would drain the pool), so it goes to calloc() instead.
+// returns nullptr (leaving size alone) if no class fits, or if the class that fits is empty.
+template<typename Config>
+void* TaggedAllocT<Config>::TakeZeroPoolBlock(size_t* size)
+{
+  assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
 
-  bool reachedInvalidEntry = false;
-  bool fragmented = false;
-  TaggedAllocationDescriptor* entry = AllocationTable;
-  int index = 0;
-  for (size_t index = start; index < AllocationTableSize; index++)
+  void* block = nullptr;
+  bool fits = false;
+  for (size_t n = 0; n < Config::ZeroPoolClasses; n++)
   {
-    bool validEntry = TAGGED_ALLOC_IS_VALID(*entry);
-    if (validEntry && reachedInvalidEntry)
+    ZeroPoolClass* zpc = &ZeroPool[n];
+    if (zpc->BlockSize == 0 || zpc->BlockSize < *size)
+    {
+      continue;
+    }
+    // this is the tightest fit, so if it's too loose there's no point looking at the bigger classes
+    if (*size <= zpc->BlockSize / 2)
     {
-      // we reached a valid entry after reaching an invalid entry, so the table is fragmented
-      *firstValidIndex = index;
-      fragmented = true;
       break;
     }
-    if (!validEntry)
+    fits = true;
+    if (zpc->ReadyCount > 0)
     {
-      // reached a invalid entry, mark it and continue.
-      if (!reachedInvalidEntry)
+      block = zpc->Ready[--zpc->ReadyCount];
+      *size = zpc->BlockSize;
+      zpc->Hits++;
+      if (!zpc->Drained)
       {
-        *firstEmptyIndex = index;
-        reachedInvalidEntry = true;
+        zpc->Drained = true;
+        zpc->DrainedTime = millis();
       }
     }
-    entry++;
+    else
+    {
+      zpc->Misses++;
+    }
+    break;
   }
-  
+
   xSemaphoreGiveRecursive(AllocationTableMutex);
-  return fragmented;
+
+  // either we took a block or we missed; both mean the refill task has work to do
+  if (fits)
+  {
+    xTaskNotifyGive(ZeroPoolTaskHandle);
+  }
+  return block;
 }
 
 
-// defragments the allocation table, shifting all descriptors to the top of the table.
-void TaggedAlloc::DefragAllocationTable()
+// tops up every pool class. the malloc() and memset() happen without the lock held; only the push is locked.
+template<typename Config>
+void TaggedAllocT<Config>::RefillZeroPool()
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
+  for (size_t n = 0; n < Config::ZeroPoolClasses; n++)
+  {
+    ZeroPoolClass* zpc = &ZeroPool[n];
+    while (true)
+    {
+      assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+      size_t blockSize = zpc->BlockSize;
+      bool full = (blockSize == 0) || (zpc->ReadyCount >= Config::ZeroPoolDepth);
+      xSemaphoreGiveRecursive(AllocationTableMutex);
+      if (full)
+      {
+        break;
+      }
 
-  size_t firstEmptyIndex = 0;
-  size_t firstValidIndex = 0;
-  // shift allocations down while we detect fragmentation
-  // this is somewhere between O(n log n) and O(n^2), but n is small enough that it should be ok, and we only do this during table shrinkage anyway.
-  while (IsAllocationTableFragmented(firstEmptyIndex, &firstEmptyIndex, &firstValidIndex))
+      void* block = TAGGED_ALLOC_MALLOC(blockSize);
+      if (block == nullptr)
+      {
+        // out of memory. don't make things worse by hoarding blocks; we'll try again after the next pooled allocation.
+        return;
+      }
+      memset(block, 0, blockSize);
+
+      assert(xSemaphoreTakeRecursive(AllocationTableMutex, Config::WaitTime) == pdTRUE);
+      zpc->Ready[zpc->ReadyCount++] = block;
+      if (zpc->ReadyCount == Config::ZeroPoolDepth && zpc->Drained)
+      {
+        zpc->Drained = false;
+        zpc->LastRefillLag = millis() - zpc->DrainedTime;
+        if (zpc->LastRefillLag > zpc->MaxRefillLag)
+        {
+          zpc->MaxRefillLag = zpc->LastRefillLag;
+        }
+      }
+      xSemaphoreGiveRecursive(AllocationTableMutex);
+    }
+  }
+}
+
+
+// idle-priority task that refills the pool whenever an allocation notifies it
+template<typename Config>
+void TaggedAllocT<Config>::ZeroPoolTask(void* parameter)
+{
+  while (true)
   {
-    // move the first valid allocation into the first empty slot
-    AllocationTable[firstEmptyIndex] = AllocationTable[firstValidIndex];
-    AllocationTable[firstValidIndex] = { 0 };
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    RefillZeroPool();
   }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
 }
 
 
-// resizes the allocation table to the given size.
-void TaggedAlloc::ResizeAllocationTable(size_t newEntryCount)
+// typed wrapper around AllocateBytes()
+template<typename Config>
+template<typename T>
+T* TaggedAllocT<Config>::AllocateInternal(size_t count, char tag[4], uint8_t flags)
 {
-  assert(newEntryCount >= TAGGED_ALLOC_MIN_TABLE_SIZE);
-  
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
+  return static_cast<T*>(AllocateBytes(count, sizeof(T), tag, flags));
+}
 
-  /*Serial.print("Resizing allocation table from ");
-  Serial.print(AllocationTableSize);
-  Serial.print(" to ");
-  Serial.print(newEntryCount);
-  Serial.println(" entries.");*/
-  if (newEntryCount != AllocationTableSize)
+
+
+/*********************************
+ * Global new/delete replacement *
+ *********************************/
+
+#ifdef TAGGED_ALLOC_REPLACE_GLOBAL_NEW
+
+// shared implementation for all of the operator new variants.
+// alignment is 0 for the normal variants. nothrow selects whether failure returns nullptr or goes through the failure policy (and then throws, if exceptions are enabled).
+static void* TaggedAllocGlobalNew(size_t size, size_t alignment, bool nothrow)
+{
+  if (size == 0)
   {
-    if (newEntryCount < AllocationTableSize)
+    size = 1;
+  }
+  if (alignment != 0)
+  {
+    // aligned_alloc() needs the size to be a multiple of the alignment
+    size = (size + alignment - 1) / alignment * alignment;
+  }
+
+  void* object;
+  if (!TaggedAlloc::IsInitialised() || TaggedAllocRecursionGuard::Active())
+  {
+    // too early to track, or the tracker itself is allocating
+    object = alignment ? aligned_alloc(alignment, size) : TAGGED_ALLOC_MALLOC(size);
+  }
+  else
+  {
+    TaggedAllocRecursionGuard guard;
+    char tag[4];
+    TaggedAllocTagScope::GetCurrentTag(tag);
+    if (alignment != 0)
     {
-      // We're shrinking the table. Need to defrag it first!
-      DefragAllocationTable();
+      object = aligned_alloc(alignment, size);
+      if (object != nullptr && !TaggedAlloc::Track(object, size, tag))
+      {
+        TAGGED_ALLOC_FREE(object);
+        object = nullptr;
+      }
     }
-    size_t newSize = newEntryCount * sizeof(TaggedAllocationDescriptor);
-    AllocationTable = static_cast<TaggedAllocationDescriptor*>(realloc(AllocationTable, newSize));
-    assert(AllocationTable != nullptr);
-    // zero the new entries if there are any
-    if (newEntryCount > AllocationTableSize)
+    else if (nothrow)
     {
-      size_t zeroOffset = AllocationTableSize * sizeof(TaggedAllocationDescriptor);
-      /*Serial.print("Zero offset: ");
-      Serial.println(zeroOffset);*/
-      size_t zeroLength = newSize - zeroOffset;
-      /*Serial.print("Zero length: ");
-      Serial.println(zeroLength);*/
-      memset(AllocationTable + AllocationTableSize, 0, zeroLength);
+      object = TaggedAlloc::TryAllocateArrayUninitialized<uint8_t>(size, tag);
+    }
+    else
+    {
+      object = TaggedAlloc::AllocateArrayUninitialized<uint8_t>(size, tag);
     }
-    AllocationTableSize = newEntryCount;
   }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
+
+#if __cpp_exceptions
+  if (object == nullptr && !nothrow)
+  {
+    throw std::bad_alloc();
+  }
+#endif
+  return object;
 }
 
 
-// inserts a new TaggedAllocationDescriptor object into the allocation table, resizing if necessary.
-void TaggedAlloc::InsertAllocation(TaggedAllocationDescriptor ta)
+// shared implementation for all of the operator delete variants
+static void TaggedAllocGlobalDelete(void* object)
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  size_t insertIndex = 0;
-  if (!GetFirstEmptySlot(&insertIndex))
+  if (object == nullptr)
   {
-    // the table is full, need to resize it.
-    ResizeAllocationTable(AllocationTableSize + TAGGED_ALLOC_TABLE_EXPAND_STEP);
+    return;
   }
-  if (!GetFirstEmptySlot(&insertIndex))
+  if (TaggedAlloc::IsInitialised())
   {
-    // critical failure, we just resized the buffer and it still didn't find an empty slot.
-    assert(false);
+    // this copes with pointers that were never tracked, e.g. ones allocated before Init()
+    TaggedAlloc::Free(object);
+  }
+  else
+  {
+    TAGGED_ALLOC_FREE(object);
   }
-  AllocationTable[insertIndex] = ta;
-  AllocationCount++;
-    
-  xSemaphoreGiveRecursive(AllocationTableMutex);
 }
 
 
-// finds an object in the allocation table, via its pointer, and removes it
-// this is called by Free()
-void TaggedAlloc::RemoveAllocation(void* objectPointer)
+void* operator new(size_t size) { return TaggedAllocGlobalNew(size, 0, false); }
+void* operator new[](size_t size) { return TaggedAllocGlobalNew(size, 0, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return TaggedAllocGlobalNew(size, 0, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return TaggedAllocGlobalNew(size, 0, true); }
+
+void operator delete(void* object) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete(void* object, const std::nothrow_t&) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object, const std::nothrow_t&) noexcept { TaggedAllocGlobalDelete(object); }
+
+#if __cpp_sized_deallocation
+void operator delete(void* object, size_t) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object, size_t) noexcept { TaggedAllocGlobalDelete(object); }
+#endif
+
+#if __cpp_aligned_new
+void* operator new(size_t size, std::align_val_t alignment) { return TaggedAllocGlobalNew(size, (size_t)alignment, false); }
+void* operator new[](size_t size, std::align_val_t alignment) { return TaggedAllocGlobalNew(size, (size_t)alignment, false); }
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return TaggedAllocGlobalNew(size, (size_t)alignment, true); }
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return TaggedAllocGlobalNew(size, (size_t)alignment, true); }
+
+void operator delete(void* object, std::align_val_t) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object, std::align_val_t) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete(void* object, std::align_val_t, const std::nothrow_t&) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object, std::align_val_t, const std::nothrow_t&) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete(void* object, size_t, std::align_val_t) noexcept { TaggedAllocGlobalDelete(object); }
+void operator delete[](void* object, size_t, std::align_val_t) noexcept { TaggedAllocGlobalDelete(object); }
+#endif
+
+#endif
+
+
+
+/**************************
+ * Heap function wrapping *
+ **************************/
+
+#ifdef TAGGED_ALLOC_WRAP_MALLOC
+
+// the address that the current function will return to, i.e. the code that called malloc().
+// on xtensa the top two bits of a return address hold the call window size rather than part of the address, so they need fixing up.
+#if defined(__XTENSA__)
+#define TAGGED_ALLOC_CALLER_ADDRESS() ((const void*)((((uintptr_t)__builtin_return_address(0)) & 0x3FFFFFFF) | 0x40000000))
+#else
+#define TAGGED_ALLOC_CALLER_ADDRESS() ((const void*)__builtin_return_address(0))
+#endif
+
+
+// tags wrapped allocations made by code between start and end (e.g. a library's text section, from the linker map) with the given tag.
+// returns false if there's no room for another range. like Init(), call this from your setup function.
+inline bool TaggedAllocMallocWrap::RegisterCallerTag(const void* start, const void* end, const char tag[4])
 {
-  assert(xSemaphoreTakeRecursive(AllocationTableMutex, TAGGED_ALLOC_WAIT_TIME) == pdTRUE);
-  
-  for (size_t n = 0; n < AllocationTableSize; n++)
+  assert(start < end);
+
+  CallerTag* callerTags = CallerTags();
+  for (size_t n = 0; n < TAGGED_ALLOC_WRAP_MAX_CALLER_TAGS; n++)
   {
-    if (TAGGED_ALLOC_IS_VALID(AllocationTable[n]))
+    if (callerTags[n].Start == nullptr)
     {
-      if (AllocationTable[n].Object == objectPointer)
-      {
-        // clear allocation
-        AllocationTable[n] = { 0 };
-        break;
-      }
+      memcpy(callerTags[n].Tag, tag, 4);
+      callerTags[n].End = end;
+      callerTags[n].Start = start;
+      return true;
     }
   }
-  AllocationCount--;
+  return false;
+}
 
-  // Have we removed enough allocations to justify shrinking the table, as long as we wouldn't be shrinking it too much?
-  if ((AllocationCount > TAGGED_ALLOC_MIN_TABLE_SIZE) && 
-     ((AllocationCount + TAGGED_ALLOC_TABLE_SHRINK_STEP) < AllocationTableSize))
+
+// should allocations on this task be tracked right now? not before Init(), and not from inside the tracker itself.
+inline bool TaggedAllocMallocWrap::ShouldTrack()
+{
+  return TaggedAlloc::IsInitialised() && !TaggedAllocRecursionGuard::Active();
+}
+
+
+// works out the tag for an allocation from the address of the code that made it
+inline void TaggedAllocMallocWrap::GetCallerTag(const void* caller, char tag[4])
+{
+  const CallerTag* callerTags = CallerTags();
+  for (size_t n = 0; n < TAGGED_ALLOC_WRAP_MAX_CALLER_TAGS && callerTags[n].Start != nullptr; n++)
   {
-    size_t shrunkSize = AllocationTableSize - TAGGED_ALLOC_TABLE_SHRINK_STEP;
-    ResizeAllocationTable(shrunkSize);
+    if (caller >= callerTags[n].Start && caller < callerTags[n].End)
+    {
+      memcpy(tag, callerTags[n].Tag, 4);
+      return;
+    }
   }
-  
-  xSemaphoreGiveRecursive(AllocationTableMutex);
+  memcpy(tag, TAGGED_ALLOC_WRAP_DEFAULT_TAG, 4);
 }
 
 
-// generic allocation function that actually builds the allocation descriptor
-template<typename T>
-T* TaggedAlloc::AllocateInternal(size_t count, char tag[4])
+// wrapped malloc(). small blocks skip tracking entirely. if the table can't grow to fit the descriptor, the block is still returned, just untracked.
+inline void* TaggedAllocMallocWrap::Malloc(size_t size, const void* caller)
 {
-  // create a descriptor
-  TaggedAllocationDescriptor ta;
-  // set the time (this is inlined, and does nothing if the TAGGED_ALLOC_NO_TIME_TRACKING preprocessor flag is set
-  SetTaggedAllocationDescriptorTime(&ta);
-  ta.Size = sizeof(T) * count;
-  // copy tag
-  ta.Tag[0] = tag[0];
-  ta.Tag[1] = tag[1];
-  ta.Tag[2] = tag[2];
-  ta.Tag[3] = tag[3];
-  // allocate object, and throw an assertion fail if the malloc() call fails
-  ta.Object = malloc(ta.Size);
-  assert(ta.Object);
-  // zero memory for safety
-  memset(ta.Object, 0, ta.Size);
-  // insert the descriptor into the allocation table
-  InsertAllocation(ta);
-  // done :)
-  return (T*)ta.Object;
+  void* object = __real_malloc(size);
+  if (object != nullptr && size >= TAGGED_ALLOC_WRAP_MIN_SIZE && ShouldTrack())
+  {
+    TaggedAllocRecursionGuard guard;
+    char tag[4];
+    GetCallerTag(caller, tag);
+    TaggedAlloc::Track(object, size, tag);
+  }
+  return object;
+}
+
+
+// wrapped calloc()
+inline void* TaggedAllocMallocWrap::Calloc(size_t count, size_t size, const void* caller)
+{
+  void* object = __real_calloc(count, size);
+  if (object != nullptr && (count * size) >= TAGGED_ALLOC_WRAP_MIN_SIZE && ShouldTrack())
+  {
+    TaggedAllocRecursionGuard guard;
+    char tag[4];
+    GetCallerTag(caller, tag);
+    TaggedAlloc::Track(object, count * size, tag);
+  }
+  return object;
+}
+
+
+// wrapped realloc(). tracked blocks are re-keyed in place (keeping their tag), and untracked blocks start being tracked if they grow past the minimum size.
+// a tracked block that shrinks below the minimum size stops being tracked, so the table never holds a descriptor for a block it can't see freed.
+// failure returns nullptr and leaves the original block alone, as realloc() should, rather than going through the failure policy.
+inline void* TaggedAllocMallocWrap::Realloc(void* object, size_t size, const void* caller)
+{
+  if (object == nullptr)
+  {
+    return Malloc(size, caller);
+  }
+  if (size == 0)
+  {
+    Free(object);
+    return nullptr;
+  }
+  if (!TaggedAlloc::IsInitialised())
+  {
+    return __real_realloc(object, size);
+  }
+
+  bool track = size >= TAGGED_ALLOC_WRAP_MIN_SIZE && !TaggedAllocRecursionGuard::Active();
+  TaggedAllocRecursionGuard guard;
+  void* newObject;
+  if (TaggedAlloc::IsTracked(object))
+  {
+    if (track)
+    {
+      // ReallocateBytes() does its own locking, and lets go of the lock if the failure policy runs
+      return TaggedAlloc::ReallocateBytes(object, size, TaggedAlloc::AllocNoPanic | TaggedAlloc::AllocNoZero);
+    }
+    // the lock is held across the realloc() so that nobody can see the descriptor pointing at a block that's already moved
+    assert(xSemaphoreTakeRecursive(TaggedAlloc::AllocationTableMutex, TaggedAllocDefaultConfig::WaitTime) == pdTRUE);
+    newObject = __real_realloc(object, size);
+    if (newObject != nullptr)
+    {
+      TaggedAlloc::Untrack(object);
+    }
+    xSemaphoreGiveRecursive(TaggedAlloc::AllocationTableMutex);
+  }
+  else
+  {
+    newObject = __real_realloc(object, size);
+    if (newObject != nullptr && track)
+    {
+      char tag[4];
+      GetCallerTag(caller, tag);
+      TaggedAlloc::Track(newObject, size, tag);
+    }
+  }
+  return newObject;
+}
+
+
+// wrapped free(). every block is looked up in the pointer index (which is constant time), rather than trusting the block's size to say whether
+// it was tracked: blocks can be tracked by Track() or shrunk by realloc(), and a missed lookup would leave a descriptor for freed memory.
+inline void TaggedAllocMallocWrap::Free(void* object)
+{
+  if (object != nullptr && TaggedAlloc::IsInitialised())
+  {
+    TaggedAllocRecursionGuard guard;
+    TaggedAlloc::Untrack(object);
+  }
+  __real_free(object);
 }
+
+
+// the symbols that the linker's --wrap redirects malloc() and friends to.
+// these are weak so that every file can include this header without multiple definition errors.
+extern "C" __attribute__((weak)) void* __wrap_malloc(size_t size) { return TaggedAllocMallocWrap::Malloc(size, TAGGED_ALLOC_CALLER_ADDRESS()); }
+extern "C" __attribute__((weak)) void* __wrap_calloc(size_t count, size_t size) { return TaggedAllocMallocWrap::Calloc(count, size, TAGGED_ALLOC_CALLER_ADDRESS()); }
+extern "C" __attribute__((weak)) void* __wrap_realloc(void* object, size_t size) { return TaggedAllocMallocWrap::Realloc(object, size, TAGGED_ALLOC_CALLER_ADDRESS()); }
+extern "C" __attribute__((weak)) void __wrap_free(void* object) { TaggedAllocMallocWrap::Free(object); }
+
+#endif